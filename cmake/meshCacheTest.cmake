@@ -0,0 +1,53 @@
+#
+# Tests that the mesh cache follows changes of its OBJ file (see
+# src/utilities/meshCache.hpp)
+#
+#   RENDERER   path of the renderer
+#   DIRECTORY  directory for the OBJ file, its cache and the image
+#
+# The file is rewritten between renders, and every render must report the
+# counts of the current contents: after the first load from the cache, after
+# a change which keeps the size of the file, after a change of the
+# modification time alone, and after a change of the size.
+#
+file (REMOVE_RECURSE ${DIRECTORY})
+file (MAKE_DIRECTORY ${DIRECTORY})
+set (MESH ${DIRECTORY}/mesh.obj)
+set (POSITIONS "v 30 20 0\nv 30 100 0\nv -50 100 0\nv -50 20 0\n")
+
+function (render EXPECTED)
+  execute_process (COMMAND ${RENDERER} -i ${MESH} -o ${DIRECTORY}/mesh.png -w 320 -h 180
+                   RESULT_VARIABLE RESULT
+                   OUTPUT_VARIABLE OUTPUT
+                   ERROR_VARIABLE OUTPUT)
+  if (NOT RESULT EQUAL 0)
+    message (FATAL_ERROR "Rendering failed (${RESULT}):\n${OUTPUT}")
+  endif ()
+  if (NOT OUTPUT MATCHES "\\(${EXPECTED}\\)")
+    message (FATAL_ERROR "Expected (${EXPECTED}):\n${OUTPUT}")
+  endif ()
+  if (NOT EXISTS ${MESH}.meshcache)
+    message (FATAL_ERROR "No cache was written for ${MESH}")
+  endif ()
+endfunction ()
+
+# The cache compares modification times, which some file systems only store
+# to the second
+function (modify CONTENTS)
+  execute_process (COMMAND ${CMAKE_COMMAND} -E sleep 1)
+  file (WRITE ${MESH} "${CONTENTS}")
+endfunction ()
+
+file (WRITE ${MESH} "${POSITIONS}f 1 2 3\nf 1 3 4\n")
+render ("4 vertices, 2 triangles")
+render ("4 vertices, 2 triangles")
+
+modify ("${POSITIONS}f 1 2 3\n# 1 3 4\n")
+render ("3 vertices, 1 triangles")
+
+execute_process (COMMAND ${CMAKE_COMMAND} -E sleep 1)
+execute_process (COMMAND ${CMAKE_COMMAND} -E touch ${MESH})
+render ("3 vertices, 1 triangles")
+
+modify ("${POSITIONS}f 1 2 3 4\n")
+render ("4 vertices, 2 triangles")
@@ -0,0 +1,63 @@
+#
+# Renders one image for a test (see the tests in CMakeLists.txt)
+#
+#   RENDERER         path of the renderer
+#   ARGUMENTS        arguments of the renderer, separated by spaces
+#   IMAGE            path of the rendered image
+#   EXPECTED_MD5     if set, the MD5 sum the image must have
+#   EXPECTED_OUTPUT  if set, a regular expression the output must match
+#   REFERENCE        if set, arguments of a second render, whose image must
+#                    be identical
+#   EXPECTED_ERROR   if set, the renderer must fail with an output matching
+#                    this regular expression
+#
+# The test fails when the renderer fails (unless EXPECTED_ERROR is set), which
+# the allocation counting build does when the rasteriser allocates memory, or
+# when the image or the output does not match.
+#
+separate_arguments (ARGUMENTS UNIX_COMMAND "${ARGUMENTS}")
+execute_process (COMMAND ${RENDERER} ${ARGUMENTS} -o ${IMAGE}
+                 RESULT_VARIABLE RESULT
+                 OUTPUT_VARIABLE OUTPUT
+                 ERROR_VARIABLE OUTPUT)
+if (DEFINED EXPECTED_ERROR)
+  if (RESULT EQUAL 0 OR NOT OUTPUT MATCHES "${EXPECTED_ERROR}")
+    message (FATAL_ERROR "Expected the error '${EXPECTED_ERROR}' (${RESULT}):\n${OUTPUT}")
+  endif ()
+  return ()
+endif ()
+if (NOT RESULT EQUAL 0)
+  message (FATAL_ERROR "Rendering failed (${RESULT}):\n${OUTPUT}")
+endif ()
+string (REGEX MATCH "Heap allocations while rasterising: [0-9]+" ALLOCATIONS "${OUTPUT}")
+message (STATUS "${ALLOCATIONS}")
+
+if (DEFINED EXPECTED_MD5)
+  file (MD5 ${IMAGE} MD5)
+  if (NOT MD5 STREQUAL EXPECTED_MD5)
+    message (FATAL_ERROR "${IMAGE} has MD5 ${MD5} instead of ${EXPECTED_MD5}")
+  endif ()
+endif ()
+
+if (DEFINED EXPECTED_OUTPUT AND NOT OUTPUT MATCHES "${EXPECTED_OUTPUT}")
+  message (FATAL_ERROR "The output does not match '${EXPECTED_OUTPUT}':\n${OUTPUT}")
+endif ()
+
+if (DEFINED REFERENCE)
+  separate_arguments (REFERENCE UNIX_COMMAND "${REFERENCE}")
+  get_filename_component (IMAGE_DIRECTORY ${IMAGE} DIRECTORY)
+  get_filename_component (IMAGE_NAME ${IMAGE} NAME_WE)
+  set (REFERENCE_IMAGE ${IMAGE_DIRECTORY}/${IMAGE_NAME}_reference.png)
+  execute_process (COMMAND ${RENDERER} ${REFERENCE} -o ${REFERENCE_IMAGE}
+                   RESULT_VARIABLE RESULT
+                   OUTPUT_VARIABLE OUTPUT
+                   ERROR_VARIABLE OUTPUT)
+  if (NOT RESULT EQUAL 0)
+    message (FATAL_ERROR "Rendering the reference failed (${RESULT}):\n${OUTPUT}")
+  endif ()
+  file (MD5 ${IMAGE} MD5)
+  file (MD5 ${REFERENCE_IMAGE} REFERENCE_MD5)
+  if (NOT MD5 STREQUAL REFERENCE_MD5)
+    message (FATAL_ERROR "${IMAGE} differs from ${REFERENCE_IMAGE}")
+  endif ()
+endif ()
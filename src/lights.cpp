@@ -0,0 +1,180 @@
+#include "lights.hpp"
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+std::vector<Light> loadLights(std::string src)
+{
+	std::ifstream lightFile(src);
+	if (!lightFile.is_open()) {
+		throw std::runtime_error("Reading light file '" + src + "' failed.");
+	}
+
+	std::vector<Light> lights;
+	std::string line;
+	unsigned int lineNumber = 0;
+
+	while (std::getline(lightFile, line)) {
+		lineNumber++;
+		std::istringstream parts(line);
+		std::string type;
+		if (!(parts >> type) || type[0] == '#') {
+			continue;
+		}
+
+		Light light;
+		light.direction = make_float3(0, 0, 0);
+		light.position = make_float3(0, 0, 0);
+		light.radius = 0;
+
+		bool valid;
+		if (type == "directional") {
+			light.type = LightType::Directional;
+			valid = bool(parts >> light.direction.x >> light.direction.y >> light.direction.z
+							   >> light.colour.x >> light.colour.y >> light.colour.z);
+			light.direction = normalize(light.direction);
+		} else if (type == "point") {
+			light.type = LightType::Point;
+			valid = bool(parts >> light.position.x >> light.position.y >> light.position.z
+							   >> light.colour.x >> light.colour.y >> light.colour.z
+							   >> light.radius) && light.radius > 0;
+		} else {
+			valid = false;
+		}
+
+		if (!valid) {
+			throw std::runtime_error("Invalid light on line " + std::to_string(lineNumber) + " of '" + src + "'.");
+		}
+		lights.push_back(light);
+	}
+
+	return lights;
+}
+
+/**
+ * Computes the screen rectangle covered by a point light
+ * @param  light  point light
+ * @param  MVP    matrix transforming world space to clipping space
+ * @param  width  width of the image
+ * @param  height height of the image
+ * @param  minX   returned first covered pixel column
+ * @param  minY   returned first covered pixel row
+ * @param  maxX   returned last covered pixel column
+ * @param  maxY   returned last covered pixel row
+ * @return        false if the light can not affect any pixel
+ */
+static bool projectLight( Light const &light,
+						  mat4x4 const &MVP,
+						  unsigned int width,
+						  unsigned int height,
+						  float &minX, float &minY, float &maxX, float &maxY )
+{
+	minX = minY = std::numeric_limits<float>::max();
+	maxX = maxY = -std::numeric_limits<float>::max();
+	float minZ = std::numeric_limits<float>::max();
+	float maxZ = -std::numeric_limits<float>::max();
+
+	// The projection of a box in front of the camera lies within the projection
+	// of its corners, and the sphere lies within its bounding box.
+	for (unsigned int corner = 0; corner < 8; corner++) {
+		float4 point;
+		point.x = light.position.x + ((corner & 1) ? light.radius : -light.radius);
+		point.y = light.position.y + ((corner & 2) ? light.radius : -light.radius);
+		point.z = light.position.z + ((corner & 4) ? light.radius : -light.radius);
+		point.w = 1;
+
+		float4 clip = transformPoint<MatrixClass::General>(MVP, point);
+		if (clip.w <= 1e-6f) {
+			// The sphere reaches behind the camera, assume it covers everything
+			minX = 0;
+			minY = 0;
+			maxX = float(width - 1);
+			maxY = float(height - 1);
+			return true;
+		}
+
+		float x = (clip.x / clip.w + 0.5f) * float(width);
+		float y = (clip.y / clip.w + 0.5f) * float(height);
+		float z = clip.z / clip.w;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, z);
+		maxZ = std::max(maxZ, z);
+	}
+
+	if (maxZ < -1 || minZ > 1) {
+		return false;
+	}
+	if (maxX < 0 || maxY < 0 || minX > float(width - 1) || minY > float(height - 1)) {
+		return false;
+	}
+
+	minX = std::max(minX, 0.0f);
+	minY = std::max(minY, 0.0f);
+	maxX = std::min(maxX, float(width - 1));
+	maxY = std::min(maxY, float(height - 1));
+	return true;
+}
+
+TileLightGrid cullLights(std::vector<Light> const &lights, mat4x4 const &MVP, unsigned int width, unsigned int height)
+{
+	TileLightGrid grid;
+	grid.tilesX = (width + TileLightGrid::tileSize - 1) / TileLightGrid::tileSize;
+	grid.tilesY = (height + TileLightGrid::tileSize - 1) / TileLightGrid::tileSize;
+
+	unsigned int tileCount = grid.tilesX * grid.tilesY;
+	std::vector<unsigned int> tileLightCounts(tileCount, 0);
+
+	// Tile ranges of every point light, computed once and used by both passes below
+	std::vector<unsigned int> ranges(4 * lights.size(), 0);
+	std::vector<bool> visible(lights.size(), false);
+
+	for (unsigned int i = 0; i < lights.size(); i++) {
+		if (lights[i].type == LightType::Directional) {
+			grid.directionalLights.push_back(i);
+			continue;
+		}
+
+		float minX, minY, maxX, maxY;
+		if (!projectLight(lights[i], MVP, width, height, minX, minY, maxX, maxY)) {
+			continue;
+		}
+		visible[i] = true;
+		ranges[4 * i + 0] = (unsigned int) minX / TileLightGrid::tileSize;
+		ranges[4 * i + 1] = (unsigned int) minY / TileLightGrid::tileSize;
+		ranges[4 * i + 2] = (unsigned int) maxX / TileLightGrid::tileSize;
+		ranges[4 * i + 3] = (unsigned int) maxY / TileLightGrid::tileSize;
+
+		for (unsigned int tileY = ranges[4 * i + 1]; tileY <= ranges[4 * i + 3]; tileY++) {
+			for (unsigned int tileX = ranges[4 * i + 0]; tileX <= ranges[4 * i + 2]; tileX++) {
+				tileLightCounts[tileY * grid.tilesX + tileX]++;
+			}
+		}
+	}
+
+	// Prefix sum of the counts gives the start of every tile's list
+	grid.tileOffsets.resize(tileCount + 1);
+	grid.tileOffsets[0] = 0;
+	for (unsigned int tile = 0; tile < tileCount; tile++) {
+		grid.tileOffsets[tile + 1] = grid.tileOffsets[tile] + tileLightCounts[tile];
+	}
+	grid.pointLights.resize(grid.tileOffsets[tileCount]);
+
+	std::vector<unsigned int> tileFill(grid.tileOffsets.begin(), grid.tileOffsets.end() - 1);
+	for (unsigned int i = 0; i < lights.size(); i++) {
+		if (!visible[i]) {
+			continue;
+		}
+		for (unsigned int tileY = ranges[4 * i + 1]; tileY <= ranges[4 * i + 3]; tileY++) {
+			for (unsigned int tileX = ranges[4 * i + 0]; tileX <= ranges[4 * i + 2]; tileX++) {
+				grid.pointLights[tileFill[tileY * grid.tilesX + tileX]++] = i;
+			}
+		}
+	}
+
+	return grid;
+}
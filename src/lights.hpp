@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "utilities/geom.hpp"
+
+// Lights of the scene, and the per-tile light lists used for tiled forward
+// shading ("Forward+").
+//
+// Lights are given in world space, the same space the normals are shaded in.
+// Directional lights affect every pixel. Point lights have a limited radius,
+// outside of which they contribute nothing, so the screen is divided into
+// tiles and every tile keeps a list of the point lights which can reach it.
+// A fragment then only loops over the lights of its own tile, and the shading
+// cost no longer grows with the total number of lights in the scene.
+
+enum class LightType {
+	Directional,
+	Point
+};
+
+typedef struct Light {
+	LightType type;
+	// Direction towards the light (directional lights)
+	float3 direction;
+	// Position of the light (point lights)
+	float3 position;
+	// Distance at which a point light no longer contributes
+	float radius;
+	// Colour and intensity, 1 is full brightness
+	float3 colour;
+} Light;
+
+/**
+ * Reads lights from a text file. Every line describes one light:
+ *
+ *     directional <dx> <dy> <dz> <r> <g> <b>
+ *     point <x> <y> <z> <r> <g> <b> <radius>
+ *
+ * Empty lines and lines starting with '#' are ignored.
+ * @param  src path of the light file
+ * @return     lights in the file
+ */
+std::vector<Light> loadLights(std::string src);
+
+typedef struct TileLightGrid {
+	static const unsigned int tileSize = 16;
+
+	unsigned int tilesX;
+	unsigned int tilesY;
+
+	// Directional lights apply to every tile
+	std::vector<unsigned int> directionalLights;
+
+	// Point lights of tile t are pointLights[tileOffsets[t] .. tileOffsets[t + 1])
+	std::vector<unsigned int> tileOffsets;
+	std::vector<unsigned int> pointLights;
+
+	/**
+	 * @return index of the tile containing the pixel
+	 */
+	unsigned int tileIndex(unsigned int x, unsigned int y) const {
+		return (y / tileSize) * tilesX + x / tileSize;
+	}
+} TileLightGrid;
+
+/**
+ * Light culling pass: determines which point lights can affect each screen
+ * tile, by projecting the bounding box of every light's sphere of influence
+ * onto the screen.
+ * @param lights lights of the scene
+ * @param MVP    matrix transforming world space to clipping space
+ * @param width  width of the image
+ * @param height height of the image
+ * @return       light lists of all tiles
+ */
+TileLightGrid cullLights(std::vector<Light> const &lights, mat4x4 const &MVP, unsigned int width, unsigned int height);
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <cstring>
+#include <exception>
+#include <thread>
 #include "utilities/OBJLoader.hpp"
+#include "utilities/parallel.hpp"
 #include "rasteriser.hpp"
 #include "sse_test.hpp"
 
@@ -10,6 +13,10 @@ int main(int argc, char **argv) {
 	unsigned int width = 1920;
 	unsigned int height = 1080;
 	bool sse = false;
+	bool stream = false;
+	size_t streamBatchTriangles = 16384;
+	RenderOptions options;
+	LoadOptions loadOptions;
 
 
 	for (int i = 1; i < argc; i++) {
@@ -22,22 +29,163 @@ int main(int argc, char **argv) {
 				width = (unsigned int) std::stoul(argv[i+1]);
 			} else if (std::strcmp("-h", argv[i]) == 0) {
 				height = (unsigned int) std::stoul(argv[i+1]);
+			} else if (std::strcmp("-t", argv[i]) == 0) {
+				setWorkerThreadCount((unsigned int) std::stoul(argv[i+1]));
+			} else if (std::strcmp("--normal-lut", argv[i]) == 0) {
+				options.normalLookupBits = (unsigned int) std::stoul(argv[i+1]);
+			} else if (std::strcmp("--coarse-shading", argv[i]) == 0) {
+				options.coarseShadingBlock = (unsigned int) std::stoul(argv[i+1]);
+			} else if (std::strcmp("--coarse-threshold", argv[i]) == 0) {
+				options.coarseShadingThreshold = std::stof(argv[i+1]);
+			} else if (std::strcmp("--stream-batch", argv[i]) == 0) {
+				streamBatchTriangles = std::stoul(argv[i+1]);
+			} else if (std::strcmp("--lod", argv[i]) == 0) {
+				loadOptions.levelsOfDetail = true;
+				if (std::strcmp("auto", argv[i+1]) == 0) {
+					options.automaticLevelOfDetail = true;
+				} else {
+					options.levelOfDetail = (unsigned int) std::stoul(argv[i+1]);
+				}
+			} else if (std::strcmp("--lod-error", argv[i]) == 0) {
+				options.lodPixelError = std::stof(argv[i+1]);
+			} else if (std::strcmp("--lights", argv[i]) == 0) {
+				options.lights = loadLights(argv[i+1]);
 			}
 		}
 		if (std::strcmp("--sse", argv[i]) == 0) {
 			sse = true;
+		} else if (std::strcmp("--vertex-cache", argv[i]) == 0) {
+			options.vertexCache = true;
+		} else if (std::strcmp("--deindexed", argv[i]) == 0) {
+			loadOptions.deindexed = true;
+		} else if (std::strcmp("--no-mesh-cache", argv[i]) == 0) {
+			loadOptions.meshCache = false;
+		} else if (std::strcmp("--optimise-mesh", argv[i]) == 0) {
+			loadOptions.optimise = true;
+		} else if (std::strcmp("--quantise", argv[i]) == 0) {
+			loadOptions.quantised = true;
+		} else if (std::strcmp("--vertex-streams", argv[i]) == 0) {
+			loadOptions.vertexStreams = true;
+		} else if (std::strcmp("--stream", argv[i]) == 0) {
+			stream = true;
+		} else if (std::strcmp("--fused", argv[i]) == 0) {
+			options.fusedPipeline = true;
+		} else if (std::strcmp("--simd-shading", argv[i]) == 0) {
+			options.simdShading = true;
+		} else if (std::strncmp("--normals=", argv[i], 10) == 0) {
+			std::string mode(argv[i] + 10);
+			if (mode == "file") {
+				loadOptions.normals = NormalGeneration::Missing;
+			} else if (mode == "smooth") {
+				loadOptions.normals = NormalGeneration::Smooth;
+			} else if (mode == "flat") {
+				loadOptions.normals = NormalGeneration::Flat;
+			} else {
+				std::cout << "--normals expects file, smooth or flat" << std::endl;
+				return 1;
+			}
+		} else if (std::strncmp("--cluster-culling=", argv[i], 18) == 0) {
+			std::string mode(argv[i] + 18);
+			if (mode == "off") {
+				options.clusterCulling = ClusterCulling::Off;
+			} else if (mode == "frustum") {
+				options.clusterCulling = ClusterCulling::Frustum;
+			} else if (mode == "backface") {
+				options.clusterCulling = ClusterCulling::Backface;
+			} else {
+				std::cout << "--cluster-culling expects off, frustum or backface" << std::endl;
+				return 1;
+			}
+		} else if (std::strncmp("--shading=", argv[i], 10) == 0) {
+			std::string mode(argv[i] + 10);
+			if (mode == "phong") {
+				options.shading = ShadingMode::Phong;
+			} else if (mode == "gouraud") {
+				options.shading = ShadingMode::Gouraud;
+			} else if (mode == "flat") {
+				options.shading = ShadingMode::Flat;
+			} else {
+				std::cout << "--shading expects phong, gouraud or flat" << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	if (options.normalLookupBits != 0 && (options.normalLookupBits < 4 || options.normalLookupBits > 12)) {
+		std::cout << "--normal-lut expects 4 to 12 bits per axis" << std::endl;
+		return 1;
+	}
+
+	if (options.coarseShadingBlock != 0 && options.coarseShadingBlock != 2 && options.coarseShadingBlock != 4) {
+		std::cout << "--coarse-shading expects blocks of 2 or 4 pixels" << std::endl;
+		return 1;
+	}
+
+	if (stream && !sse) {
+		if (streamBatchTriangles == 0) {
+			std::cout << "--stream-batch expects at least 1 triangle" << std::endl;
+			return 1;
+		}
+		std::cout << "Streaming '" << input << "' in batches of " << streamBatchTriangles << " triangles" << std::endl;
+		if (loadOptions.optimise) {
+			std::cout << "Streamed batches are not optimised, --optimise-mesh only applies to a cached mesh" << std::endl;
 		}
+
+		// The loader parses the next batches while the current one is rendered.
+		// A few batches in flight keep both busy without holding the whole mesh.
+		BoundedQueue<Mesh> queue(4);
+		std::exception_ptr loadError;
+		std::thread loader([&]() {
+			try {
+				streamOBJ(input, loadOptions, streamBatchTriangles, queue);
+			} catch (...) {
+				loadError = std::current_exception();
+			}
+			queue.close();
+		});
+
+		Renderer renderer(width, height, options);
+		size_t batchCount = 0;
+		size_t triangleCount = 0;
+		Mesh batch;
+		try {
+			while (queue.pop(batch)) {
+				renderer.draw(batch);
+				batchCount++;
+				triangleCount += batch.indexCount / 3;
+			}
+		} catch (...) {
+			queue.close();
+			loader.join();
+			throw;
+		}
+		loader.join();
+		if (loadError) {
+			std::rethrow_exception(loadError);
+		}
+		std::cout << "Streamed " << triangleCount << " triangles in " << batchCount << " batches" << std::endl;
+		renderer.writeImage(output);
+		return 0;
 	}
 
 	std::cout << "Loading '" << input << "' file... " ;
-	Mesh mesh = loadOBJ(input);
-	std::cout << "complete!" << std::endl;
+	MeshOptimisationReport optimisation;
+	Mesh mesh = loadOBJ(input, loadOptions, &optimisation);
+	std::cout << "complete! (" << mesh.vertexCount << " vertices, " << mesh.indexCount / 3 << " triangles)" << std::endl;
+	if (optimisation.optimised) {
+		std::cout << "Mesh optimisation: ACMR " << optimisation.before.averageCacheMissRatio
+				  << " -> " << optimisation.after.averageCacheMissRatio
+				  << ", overdraw " << optimisation.before.overdraw
+				  << " -> " << optimisation.after.overdraw << std::endl;
+	} else if (loadOptions.optimise) {
+		std::cout << "Mesh optimisation: loaded the optimised mesh from the mesh cache" << std::endl;
+	}
 	if (sse) {
 		std::cout << "Running SSE test..." << std::endl;
 		sse_test(mesh);
 		std::cout << "SSE test finished!" << std::endl;
 	} else {
-		rasterise(mesh, output, width, height);
+		rasterise(mesh, output, width, height, options);
 	}
 
 	return 0;
@@ -0,0 +1,286 @@
+#include "meshlets.hpp"
+#include <cmath>
+#include <limits>
+
+// Vertices of a meshlet which have been counted already
+static const unsigned int noMeshlet = std::numeric_limits<unsigned int>::max();
+
+// Margins of the culling tests, so that rounding never culls a visible meshlet:
+// 1% of the screen on every side, and the depth margin of triangle setup
+static const double screenMargin = 0.01;
+static const double depthMargin = 1e-3;
+
+typedef struct LinearFunction {
+	// f(p) = x * p.x + y * p.y + z * p.z + constant
+	double x, y, z, constant;
+
+	LinearFunction(double x, double y, double z, double constant) {
+		this->x = x;
+		this->y = y;
+		this->z = z;
+		this->constant = constant;
+	}
+
+	LinearFunction operator+(LinearFunction const &other) const {
+		return LinearFunction(x + other.x, y + other.y, z + other.z, constant + other.constant);
+	}
+
+	LinearFunction operator*(double factor) const {
+		return LinearFunction(x * factor, y * factor, z * factor, constant * factor);
+	}
+
+	/**
+	 * @return smallest value of the function within the sphere
+	 */
+	double minimum(Meshlet const &meshlet) const {
+		return centreValue(meshlet) - meshlet.radius * std::sqrt(x * x + y * y + z * z);
+	}
+
+	/**
+	 * @return largest value of the function within the sphere
+	 */
+	double maximum(Meshlet const &meshlet) const {
+		return centreValue(meshlet) + meshlet.radius * std::sqrt(x * x + y * y + z * z);
+	}
+
+private:
+	double centreValue(Meshlet const &meshlet) const {
+		return x * meshlet.centre.x + y * meshlet.centre.y + z * meshlet.centre.z + constant;
+	}
+} LinearFunction;
+
+/**
+ * Computes the bounding sphere and normal cone of a meshlet
+ * @param meshlet meshlet with its triangle range set
+ * @param mesh    Mesh object
+ */
+static void computeMeshletBounds(Meshlet &meshlet, Mesh const &mesh)
+{
+	size_t firstCorner = 3 * meshlet.firstTriangle;
+	unsigned int cornerCount = 3 * meshlet.triangleCount;
+
+	float4 first = mesh.position(mesh.index(firstCorner));
+	double lower[3] = {first.x, first.y, first.z};
+	double upper[3] = {lower[0], lower[1], lower[2]};
+	for (unsigned int i = 1; i < cornerCount; i++) {
+		float4 vertex = mesh.position(mesh.index(firstCorner + i));
+		lower[0] = std::min(lower[0], double(vertex.x));
+		lower[1] = std::min(lower[1], double(vertex.y));
+		lower[2] = std::min(lower[2], double(vertex.z));
+		upper[0] = std::max(upper[0], double(vertex.x));
+		upper[1] = std::max(upper[1], double(vertex.y));
+		upper[2] = std::max(upper[2], double(vertex.z));
+	}
+	meshlet.centre = make_float3(float(0.5 * (lower[0] + upper[0])), float(0.5 * (lower[1] + upper[1])), float(0.5 * (lower[2] + upper[2])));
+
+	double radiusSquared = 0;
+	for (unsigned int i = 0; i < cornerCount; i++) {
+		float4 vertex = mesh.position(mesh.index(firstCorner + i));
+		double dx = double(vertex.x) - meshlet.centre.x;
+		double dy = double(vertex.y) - meshlet.centre.y;
+		double dz = double(vertex.z) - meshlet.centre.z;
+		radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+	}
+	// Rounded up, so that the sphere still holds every vertex as a float
+	meshlet.radius = float(std::sqrt(radiusSquared) * (1 + 1e-5)) + 1e-6f;
+
+	// Unit normals of the triangles; the axis of the cone is their average
+	std::vector<double> normals(3 * meshlet.triangleCount);
+	double axis[3] = {0, 0, 0};
+	bool degenerate = false;
+	for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+		float4 v0 = mesh.position(mesh.index(firstCorner + 3 * t + 0));
+		float4 v1 = mesh.position(mesh.index(firstCorner + 3 * t + 1));
+		float4 v2 = mesh.position(mesh.index(firstCorner + 3 * t + 2));
+		double e1[3] = {double(v1.x) - v0.x, double(v1.y) - v0.y, double(v1.z) - v0.z};
+		double e2[3] = {double(v2.x) - v0.x, double(v2.y) - v0.y, double(v2.z) - v0.z};
+		double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+		double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		// A triangle without a direction may still be rasterised after rounding
+		if (!(length > 0) || !std::isfinite(length)) {
+			degenerate = true;
+			break;
+		}
+		for (unsigned int k = 0; k < 3; k++) {
+			normals[3 * t + k] = n[k] / length;
+			axis[k] += n[k] / length;
+		}
+	}
+
+	meshlet.coneAxis = make_float3(0, 0, 1);
+	meshlet.coneCosine = -1;
+	double axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	if (degenerate || !(axisLength > 0)) {
+		return;
+	}
+	meshlet.coneAxis = make_float3(float(axis[0] / axisLength), float(axis[1] / axisLength), float(axis[2] / axisLength));
+
+	double cosine = 1;
+	for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+		cosine = std::min(cosine, normals[3 * t + 0] * meshlet.coneAxis.x +
+								  normals[3 * t + 1] * meshlet.coneAxis.y +
+								  normals[3 * t + 2] * meshlet.coneAxis.z);
+	}
+	// Rounded down, the cone widens a little
+	meshlet.coneCosine = float(std::max(cosine - 1e-5, -1.0));
+}
+
+std::vector<Meshlet> buildMeshlets(Mesh const &mesh)
+{
+	std::vector<Meshlet> meshlets;
+	// Number of the last meshlet which used every vertex
+	std::vector<unsigned int> lastMeshlet(mesh.vertexCount, noMeshlet);
+
+	size_t triangleCount = mesh.indexCount / 3;
+	Meshlet meshlet;
+	meshlet.firstTriangle = 0;
+	meshlet.triangleCount = 0;
+	meshlet.vertexCount = 0;
+
+	for (size_t t = 0; t < triangleCount; t++) {
+		unsigned int corners[3] = {mesh.index(3 * t + 0), mesh.index(3 * t + 1), mesh.index(3 * t + 2)};
+		unsigned int current = (unsigned int) meshlets.size();
+
+		unsigned int newVertices = 0;
+		for (unsigned int k = 0; k < 3; k++) {
+			bool seen = lastMeshlet[corners[k]] == current ||
+						(k > 0 && corners[k] == corners[0]) ||
+						(k > 1 && corners[k] == corners[1]);
+			newVertices += seen ? 0 : 1;
+		}
+
+		if (meshlet.triangleCount == Meshlet::maxTriangles || meshlet.vertexCount + newVertices > Meshlet::maxVertices) {
+			computeMeshletBounds(meshlet, mesh);
+			meshlets.push_back(meshlet);
+			current++;
+			meshlet.firstTriangle = t;
+			meshlet.triangleCount = 0;
+			meshlet.vertexCount = 0;
+		}
+
+		for (unsigned int k = 0; k < 3; k++) {
+			if (lastMeshlet[corners[k]] != current) {
+				lastMeshlet[corners[k]] = current;
+				meshlet.vertexCount++;
+			}
+		}
+		meshlet.triangleCount++;
+	}
+
+	if (meshlet.triangleCount != 0) {
+		computeMeshletBounds(meshlet, mesh);
+		meshlets.push_back(meshlet);
+	}
+	return meshlets;
+}
+
+/**
+ * Tests whether a meshlet lies entirely outside of the view frustum. The
+ * clipping space coordinates are linear in the position, so their range over
+ * the bounding sphere follows from the rows of the MVP matrix. The tests only
+ * hold for vertices on one side of the camera: w changes the sign of the
+ * coordinates after the perspective division.
+ * @param  meshlet meshlet
+ * @param  MVP     matrix transforming the mesh to clipping space
+ * @return         true if triangle setup would cull all of its triangles
+ */
+static bool outsideFrustum(Meshlet const &meshlet, mat4x4 const &MVP)
+{
+	LinearFunction x(MVP.m00, MVP.m01, MVP.m02, MVP.m03);
+	LinearFunction y(MVP.m10, MVP.m11, MVP.m12, MVP.m13);
+	LinearFunction z(MVP.m20, MVP.m21, MVP.m22, MVP.m23);
+	LinearFunction w(MVP.m30, MVP.m31, MVP.m32, MVP.m33);
+
+	double sideLimit = 0.5 + screenMargin;
+	double depthLimit = 1 + depthMargin;
+
+	if (w.maximum(meshlet) < 0) {
+		// Behind the camera only the depth test applies: z / w > 1 or z / w < -1
+		return (w * depthLimit + z * -1).minimum(meshlet) > 0 ||
+			   (z + w * depthLimit).minimum(meshlet) > 0;
+	}
+	if (w.minimum(meshlet) > 0) {
+		return (x + w * sideLimit).maximum(meshlet) < 0 ||
+			   (x + w * -sideLimit).minimum(meshlet) > 0 ||
+			   (y + w * sideLimit).maximum(meshlet) < 0 ||
+			   (y + w * -sideLimit).minimum(meshlet) > 0 ||
+			   (z + w * depthLimit).maximum(meshlet) < 0 ||
+			   (z + w * -depthLimit).minimum(meshlet) > 0;
+	}
+	return false;
+}
+
+/**
+ * Tests whether every triangle of a meshlet faces away from the camera, for
+ * every point of the bounding sphere and every normal in the cone. With the
+ * angle theta between the cone axis and the direction from the camera to the
+ * centre, the normals make an angle of at most theta + alpha with that
+ * direction, where alpha is the angle of the cone.
+ * @param  meshlet meshlet
+ * @param  camera  position of the camera in the space of the mesh
+ * @return         true if the meshlet is back-facing
+ */
+static bool backFacing(Meshlet const &meshlet, double const camera[3])
+{
+	if (meshlet.coneCosine <= 0) {
+		return false;
+	}
+	double view[3] = {meshlet.centre.x - camera[0], meshlet.centre.y - camera[1], meshlet.centre.z - camera[2]};
+	double distance = std::sqrt(view[0] * view[0] + view[1] * view[1] + view[2] * view[2]);
+	if (!(distance > meshlet.radius)) {
+		return false;
+	}
+
+	double cosTheta = (view[0] * meshlet.coneAxis.x + view[1] * meshlet.coneAxis.y + view[2] * meshlet.coneAxis.z) / distance;
+	double sinTheta = std::sqrt(std::max(0.0, 1 - cosTheta * cosTheta));
+	double cosAlpha = meshlet.coneCosine;
+	double sinAlpha = std::sqrt(1 - cosAlpha * cosAlpha);
+	double cosSum = cosTheta * cosAlpha - sinTheta * sinAlpha;
+	return distance * cosSum > meshlet.radius * (1 + 1e-4);
+}
+
+ClusterCullingStatistics cullMeshlets(std::vector<Meshlet> const &meshlets, Mesh const &mesh, mat4x4 const &MVP, ClusterCulling mode,
+									  std::vector<unsigned int> &indices, std::vector<unsigned char> &vertexMask)
+{
+	ClusterCullingStatistics statistics;
+	statistics.meshlets = meshlets.size();
+	statistics.triangles = mesh.indexCount / 3;
+
+	// The camera is the point which the MVP matrix maps to w = 0 on the axis
+	// of the view, (0, 0, 1, 0) in clipping space. An orthographic camera lies
+	// at infinity and is left out.
+	mat4x4 inverseMVP = inverse(MVP);
+	double camera[3] = {0, 0, 0};
+	bool cameraKnown = false;
+	if (mode == ClusterCulling::Backface && std::fabs(inverseMVP.m32) > 1e-12f) {
+		camera[0] = double(inverseMVP.m02) / inverseMVP.m32;
+		camera[1] = double(inverseMVP.m12) / inverseMVP.m32;
+		camera[2] = double(inverseMVP.m22) / inverseMVP.m32;
+		cameraKnown = std::isfinite(camera[0]) && std::isfinite(camera[1]) && std::isfinite(camera[2]);
+	}
+
+	indices.clear();
+	vertexMask.assign(mesh.vertexCount, 0);
+	for (size_t i = 0; i < meshlets.size(); i++) {
+		Meshlet const &meshlet = meshlets[i];
+		if (mode == ClusterCulling::Off) {
+			// nothing is culled
+		} else if (outsideFrustum(meshlet, MVP)) {
+			statistics.frustumCulled++;
+			continue;
+		} else if (cameraKnown && backFacing(meshlet, camera)) {
+			statistics.backfaceCulled++;
+			continue;
+		}
+
+		size_t begin = 3 * meshlet.firstTriangle;
+		size_t end = begin + 3 * meshlet.triangleCount;
+		for (size_t corner = begin; corner < end; corner++) {
+			unsigned int index = mesh.index(corner);
+			indices.push_back(index);
+			vertexMask[index] = 1;
+		}
+		statistics.visibleTriangles += meshlet.triangleCount;
+	}
+	return statistics;
+}
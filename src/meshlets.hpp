@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "utilities/geom.hpp"
+#include "utilities/OBJLoader.hpp"
+
+// Meshlets: small clusters of neighbouring triangles, and the cluster culling
+// pass which rejects whole meshlets before any of their vertices is transformed.
+//
+// A meshlet is a contiguous range of the index buffer with at most 64 distinct
+// vertices and 124 triangles, so a meshlet of a mesh ordered for the vertex
+// cache (see utilities/meshOptimiser.hpp) covers a compact patch of the surface.
+// Every meshlet keeps a bounding sphere of its vertices, and a cone which holds
+// the normals of all its triangles. Culling a meshlet is then a handful of dot
+// products, instead of transforming up to 64 vertices and setting up 124 triangles.
+
+typedef struct Meshlet {
+	static const unsigned int maxVertices = 64;
+	static const unsigned int maxTriangles = 124;
+
+	// The meshlet draws triangles firstTriangle .. firstTriangle + triangleCount - 1
+	size_t firstTriangle;
+	unsigned int triangleCount;
+	unsigned int vertexCount;
+
+	// Bounding sphere of the vertices
+	float3 centre;
+	float radius;
+
+	// The normals of all triangles (counter-clockwise winding) lie within the
+	// angle of the cone around its axis. A cosine of -1 means the cone holds
+	// every direction, and the meshlet is never back-facing.
+	float3 coneAxis;
+	float coneCosine;
+} Meshlet;
+
+// Which meshlets the cluster culling pass rejects
+enum class ClusterCulling {
+	// None, every triangle goes through the vertex stage
+	Off,
+	// Meshlets outside of the view frustum. Triangle setup would cull all of
+	// their triangles anyway, so the image does not change.
+	Frustum,
+	// Also meshlets of which every triangle faces away from the camera. The
+	// rasteriser draws both sides of triangles, so the image only stays the
+	// same for closed meshes, where the back faces are hidden by the front faces.
+	Backface
+};
+
+typedef struct ClusterCullingStatistics {
+	size_t meshlets;
+	size_t frustumCulled;
+	size_t backfaceCulled;
+	size_t triangles;
+	size_t visibleTriangles;
+
+	ClusterCullingStatistics() {
+		meshlets = 0;
+		frustumCulled = 0;
+		backfaceCulled = 0;
+		triangles = 0;
+		visibleTriangles = 0;
+	}
+} ClusterCullingStatistics;
+
+/**
+ * Splits a mesh into meshlets, in the order of its index buffer
+ * @param  mesh Mesh object
+ * @return      meshlets covering all triangles of the mesh
+ */
+std::vector<Meshlet> buildMeshlets(Mesh const &mesh);
+
+/**
+ * Cluster culling pass: determines the triangles of the meshlets which may be visible
+ * @param meshlets   meshlets of the mesh
+ * @param mesh       Mesh object the meshlets were built from
+ * @param MVP        matrix transforming the mesh to clipping space
+ * @param mode       which meshlets to reject
+ * @param indices    returned index buffer with the triangles of the remaining
+ *                   meshlets, in their original order
+ * @param vertexMask returned flags, 1 for every vertex those triangles use
+ * @return           number of culled meshlets and remaining triangles
+ */
+ClusterCullingStatistics cullMeshlets(std::vector<Meshlet> const &meshlets, Mesh const &mesh, mat4x4 const &MVP, ClusterCulling mode,
+									  std::vector<unsigned int> &indices, std::vector<unsigned char> &vertexMask);
@@ -1,5 +1,13 @@
 #include "rasteriser.hpp"
 #include "utilities/lodepng.h"
+#include "utilities/parallel.hpp"
+#include "utilities/allocationCounter.hpp"
+#include "utilities/simd.hpp"
+#include "vertexCache.hpp"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 
 // --- Overview ---
@@ -24,96 +32,677 @@
 // A "fragment shader" is run on each rendered pixel, which determines the colour the pixel should receive.
 // The rendered image is stored in the so-called "framebuffer".
 
+// Buffers written by the vertex shader. Their pages are left untouched on
+// allocation so that each worker thread places its own chunk (see parallel.hpp).
+typedef std::vector<float4, FirstTouchAllocator<float4> > TransformedBuffer;
+
 
 /**
- * Executes the vertex shader, transforms vertices and normals of the mesh object
- * @param mesh                    Mesh object with all vertices and normals
- * @param transformedVertexBuffer returned transformed vertices
- * @param transformedNormalBuffer returned transformed normals
+ * Everything the rasteriser needs to know about a single triangle: its
+ * vertices in screen pixel coordinates, its normals, and the range of pixels
+ * it can possibly cover.
+ */
+typedef struct TriangleSetup {
+	float4 vertices[3];
+	float4 normals[3];
+
+	// Inclusive pixel bounding box, clipped to the screen
+	unsigned int minX, minY;
+	unsigned int maxX, maxY;
+} TriangleSetup;
+
+// Triangle setups are produced in chunks, one per worker thread. Rasterising
+// the chunks in order keeps the triangles in their original order.
+typedef std::vector<TriangleSetup> TriangleSetupBuffer;
+
+// Largest number of triangles a worker thread sets up before they are
+// rasterised (see TriangleSetupStream). Bounds the setup buffers to about
+// 450 KB per thread, however many triangles a mesh has.
+static const size_t triangleSetupBatchSize = 4096;
+
+/**
+ * Matrices used by the vertex shader to transform the vertices and normals,
+ * and their classes. The classes are determined once when the matrices are set
+ * up, and select the specialised transformation kernels (see geom.hpp).
+ */
+typedef struct VertexShaderMatrices {
+	mat4x4 MVP;
+	mat4x4 normalMatrix;
+
+	MatrixClass MVPClass;
+	MatrixClass normalMatrixClass;
+} VertexShaderMatrices;
+
+/**
+ * Sets up the matrices used to transform the vertices and normals
+ * @return vertex shader matrices
+ */
+VertexShaderMatrices getVertexShaderMatrices()
+{
+	// The matrices themselves are defined and composed at compile time in geom.hpp
+	constexpr mat4x4 MVP = projectionMatrix * viewMatrix;
+
+	VertexShaderMatrices matrices;
+	matrices.MVP = MVP;
+	matrices.normalMatrix = identityMatrix;
+	matrices.MVPClass = classifyMatrix(matrices.MVP);
+	matrices.normalMatrixClass = classifyMatrix(matrices.normalMatrix);
+	return matrices;
+}
+
+/**
+ * Transforms 8 points the way transformPoint (see geom.hpp) transforms one.
+ * The operations and their order are the same, so are the results.
+ * @param m           matrix of the given class
+ * @param x           x coordinates of the points
+ * @param y           y coordinates of the points
+ * @param z           z coordinates of the points
+ * @param transformed returned x, y, z and w coordinates of the transformed points
  */
-void runVertexShader( Mesh &mesh,
-					  std::vector<float4> &transformedVertexBuffer,
-					  std::vector<float4> &transformedNormalBuffer )
+template <MatrixClass Class>
+inline void transformPoints8( mat4x4 const &m, float8 const &x, float8 const &y, float8 const &z, float8 (&transformed)[4] )
 {
-	// The & in front of the variable names cause the function to modify variables from the function
-	// calling this one, rather than making a copy of them.
-
-	// The matrices defined below are the ones used to transform the vertices and normals.
-
-	// This projection matrix assumes a 16:9 aspect ratio, and an field of view (FOV) of 90 degrees.
-	mat4x4 projectionMatrix(
-		0.347270,   0, 			0, 		0,
-		0,	  		0.617370, 	0,		0,
-		0,	  		0,			-1, 	-0.2f,
-		0,	  		0,			-1,		0);
-
-	mat4x4 viewMatrix(
-		0.5, 	0, 		0, 		5,
-		0, 		-0.5, 	0, 		30,
-		0, 		0, 		0.5, 	-55,
-		0, 		0, 		0, 		1);
-
-	mat4x4 normalMatrix(
-		1, 0, 0, 0,
-		0, 1, 0, 0,
-		0, 0, 1, 0,
-		0, 0, 0, 1);
-
-	mat4x4 MVP = projectionMatrix * viewMatrix;
-
-	for(unsigned int i = 0; i < transformedVertexBuffer.size(); i++) {
-		float4 transformed = MVP * mesh.vertices[i];
-		transformed.x /= transformed.w;
-		transformed.y /= transformed.w;
-		transformed.z /= transformed.w;
-		transformedVertexBuffer.at(i) = transformed;
-	}
-
-	for(unsigned int j = 0; j < transformedNormalBuffer.size(); j++) {
-		float4 normal;
-		normal.x = mesh.normals[j].x;
-		normal.y = mesh.normals[j].y;
-		normal.z = mesh.normals[j].z;
-		normal.w = 1;
-		transformedNormalBuffer.at(j) = normalMatrix * normal;
+	float8 const ones = {1, 1, 1, 1, 1, 1, 1, 1};
+	if(Class == MatrixClass::Identity) {
+		transformed[0] = x;
+		transformed[1] = y;
+		transformed[2] = z;
+		transformed[3] = ones;
+		return;
+	}
+	transformed[0] = m.m00 * x + m.m01 * y + m.m02 * z + m.m03;
+	transformed[1] = m.m10 * x + m.m11 * y + m.m12 * z + m.m13;
+	transformed[2] = m.m20 * x + m.m21 * y + m.m22 * z + m.m23;
+	if(Class == MatrixClass::Affine) {
+		transformed[3] = ones;
+	} else if(Class == MatrixClass::Perspective) {
+		transformed[3] = m.m32 * z + m.m33;
+	} else {
+		transformed[3] = m.m30 * x + m.m31 * y + m.m32 * z + m.m33;
 	}
 }
 
 /**
- * Executes the fragment shader to calculate the colour of the pixel from its
- * normal
- * @param normal triangle pixel normal
- * @return		 colour of the pixel in RGBA
+ * The vertex shader for a given combination of matrix classes and vertex
+ * layout. Every stage that transforms vertices is instantiated once per
+ * combination (see dispatchVertexShader), so the per-vertex code never
+ * branches on the classes or on the layout.
+ */
+template <MatrixClass MVPClass, MatrixClass normalMatrixClass, bool quantisedVertices>
+struct VertexShader {
+	VertexShaderMatrices matrices;
+
+	/**
+	 * Transforms a single vertex to clipping space
+	 * @param  vertex vertex of the mesh
+	 * @return        transformed vertex
+	 */
+	float4 transformVertex( float4 const vertex ) const
+	{
+		float4 transformed = transformPoint<MVPClass>(matrices.MVP, vertex);
+		// The perspective division is only needed when w can differ from 1
+		if(MVPClass == MatrixClass::Perspective || MVPClass == MatrixClass::General) {
+			transformed.x /= transformed.w;
+			transformed.y /= transformed.w;
+			transformed.z /= transformed.w;
+		}
+		return transformed;
+	}
+
+	/**
+	 * Transforms a single normal
+	 * @param  normal normal of the mesh
+	 * @return        transformed normal
+	 */
+	float4 transformNormal( float3 const normal ) const
+	{
+		float4 extended;
+		extended.x = normal.x;
+		extended.y = normal.y;
+		extended.z = normal.z;
+		extended.w = 1;
+		return transformPoint<normalMatrixClass>(matrices.normalMatrix, extended);
+	}
+
+	/**
+	 * Reads a vertex of a mesh, decoding a quantised one, and transforms it
+	 * @param  mesh  Mesh object
+	 * @param  index index of the vertex
+	 * @return       transformed vertex
+	 */
+	float4 transformVertex( Mesh const &mesh, size_t const index ) const
+	{
+		return transformVertex(quantisedVertices ?
+			dequantisePosition(mesh.quantisedVertices[index], mesh.quantisationOffset, mesh.quantisationScale) :
+			mesh.vertices[index]);
+	}
+
+	/**
+	 * Reads the normal of a vertex of a mesh, decoding a quantised one, and transforms it
+	 * @param  mesh  Mesh object
+	 * @param  index index of the vertex
+	 * @return       transformed normal
+	 */
+	float4 transformNormal( Mesh const &mesh, size_t const index ) const
+	{
+		return transformNormal(quantisedVertices ? dequantiseNormal(mesh.quantisedVertices[index]) : mesh.normals[index]);
+	}
+
+	/**
+	 * Transforms 8 consecutive vertices and their normals, read from the vertex
+	 * streams of a mesh. The results equal those of transformVertex and transformNormal.
+	 * @param streams  vertex streams of the mesh
+	 * @param first    index of the first vertex
+	 * @param vertices returned transformed vertices
+	 * @param normals  returned transformed normals
+	 */
+	void transformVertices8( VertexStreams const &streams, size_t const first, float4 *vertices, float4 *normals ) const
+	{
+		float8 coordinates[6];
+		float const *arrays[6] = {streams.x, streams.y, streams.z, streams.normalX, streams.normalY, streams.normalZ};
+		for(unsigned int i = 0; i < 6; i++) {
+			std::memcpy(&coordinates[i], arrays[i] + first, sizeof(float8));
+		}
+
+		float8 transformed[4];
+		transformPoints8<MVPClass>(matrices.MVP, coordinates[0], coordinates[1], coordinates[2], transformed);
+		if(MVPClass == MatrixClass::Perspective || MVPClass == MatrixClass::General) {
+			transformed[0] /= transformed[3];
+			transformed[1] /= transformed[3];
+			transformed[2] /= transformed[3];
+		}
+		for(unsigned int lane = 0; lane < 8; lane++) {
+			vertices[lane].x = transformed[0][lane];
+			vertices[lane].y = transformed[1][lane];
+			vertices[lane].z = transformed[2][lane];
+			vertices[lane].w = transformed[3][lane];
+		}
+
+		transformPoints8<normalMatrixClass>(matrices.normalMatrix, coordinates[3], coordinates[4], coordinates[5], transformed);
+		for(unsigned int lane = 0; lane < 8; lane++) {
+			normals[lane].x = transformed[0][lane];
+			normals[lane].y = transformed[1][lane];
+			normals[lane].z = transformed[2][lane];
+			normals[lane].w = transformed[3][lane];
+		}
+	}
+};
+
+template <MatrixClass MVPClass, MatrixClass normalMatrixClass, typename Stage>
+void dispatchVertexLayout( VertexShaderMatrices const &matrices, bool const quantised, Stage &stage )
+{
+	if (quantised) {
+		stage(VertexShader<MVPClass, normalMatrixClass, true>{matrices});
+	} else {
+		stage(VertexShader<MVPClass, normalMatrixClass, false>{matrices});
+	}
+}
+
+template <MatrixClass MVPClass, typename Stage>
+void dispatchNormalMatrixClass( VertexShaderMatrices const &matrices, bool const quantised, Stage &stage )
+{
+	switch(matrices.normalMatrixClass) {
+	case MatrixClass::Identity:
+		dispatchVertexLayout<MVPClass, MatrixClass::Identity>(matrices, quantised, stage);
+		break;
+	case MatrixClass::Affine:
+		dispatchVertexLayout<MVPClass, MatrixClass::Affine>(matrices, quantised, stage);
+		break;
+	case MatrixClass::Perspective:
+		dispatchVertexLayout<MVPClass, MatrixClass::Perspective>(matrices, quantised, stage);
+		break;
+	case MatrixClass::General:
+		dispatchVertexLayout<MVPClass, MatrixClass::General>(matrices, quantised, stage);
+		break;
+	}
+}
+
+/**
+ * Calls stage(shader) with the vertex shader specialised for the classes of
+ * the given matrices and for the vertex layout of the mesh
+ * @param matrices vertex shader matrices
+ * @param mesh     Mesh object the stage transforms
+ * @param stage    functor with a templated operator() taking a VertexShader
+ */
+template <typename Stage>
+void dispatchVertexShader( VertexShaderMatrices const &matrices, Mesh const &mesh, Stage &stage )
+{
+	bool quantised = mesh.quantisedVertices != nullptr;
+	switch(matrices.MVPClass) {
+	case MatrixClass::Identity:
+		dispatchNormalMatrixClass<MatrixClass::Identity>(matrices, quantised, stage);
+		break;
+	case MatrixClass::Affine:
+		dispatchNormalMatrixClass<MatrixClass::Affine>(matrices, quantised, stage);
+		break;
+	case MatrixClass::Perspective:
+		dispatchNormalMatrixClass<MatrixClass::Perspective>(matrices, quantised, stage);
+		break;
+	case MatrixClass::General:
+		dispatchNormalMatrixClass<MatrixClass::General>(matrices, quantised, stage);
+		break;
+	}
+}
+
+/**
+ * Executes the vertex shader, transforms vertices and normals of the mesh object
+ */
+typedef struct VertexShaderStage {
+	// Mesh object with all vertices and normals
+	Mesh &mesh;
+	// returned transformed vertices
+	TransformedBuffer &transformedVertexBuffer;
+	// returned transformed normals
+	TransformedBuffer &transformedNormalBuffer;
+	// if not null, only vertices with a non-zero flag are transformed
+	unsigned char const *vertexMask;
+
+	template <typename Shader>
+	void operator()( Shader const &shader )
+	{
+		if(vertexMask != nullptr) {
+			parallelFor(transformedVertexBuffer.size(), [&](size_t begin, size_t end, unsigned int) {
+				for(size_t i = begin; i < end; i++) {
+					if(vertexMask[i] != 0) {
+						transformedVertexBuffer[i] = shader.transformVertex(mesh, i);
+						transformedNormalBuffer[i] = shader.transformNormal(mesh, i);
+					}
+				}
+			});
+			return;
+		}
+
+		// Every vertex is independent of all others, so the buffers are split into
+		// one contiguous chunk per worker thread. Each thread transforms both the
+		// vertices and the normals of its own chunk, so the pages of both buffers
+		// are first written (and placed) by the thread that owns them.
+		bool streams = mesh.streams.x != nullptr && mesh.quantisedVertices == nullptr;
+		parallelFor(transformedVertexBuffer.size(), [&](size_t begin, size_t end, unsigned int) {
+			// Vertex streams are read 8 vertices at a time, the rest of the chunk one by one
+			if(streams) {
+				for(; begin + 8 <= end; begin += 8) {
+					shader.transformVertices8(mesh.streams, begin, &transformedVertexBuffer[begin], &transformedNormalBuffer[begin]);
+				}
+			}
+
+			for(size_t i = begin; i < end; i++) {
+				transformedVertexBuffer[i] = shader.transformVertex(mesh, i);
+			}
+
+			for(size_t j = begin; j < end; j++) {
+				transformedNormalBuffer[j] = shader.transformNormal(mesh, j);
+			}
+		});
+	}
+} VertexShaderStage;
+
+/**
+ * Executes the vertex shader lazily: vertices are only transformed when the
+ * index buffer first references them, and a flag per vertex makes sure each of
+ * them is transformed once. Vertices which no triangle references are skipped.
+ * Walking the index buffer is sequential, so this variant runs on a single
+ * thread. The post-transform vertex cache (see vertexCache.hpp) is simulated
+ * on the index buffer alongside, to report how well it is ordered.
+ */
+typedef struct CachedVertexShaderStage {
+	// Mesh object with all vertices, normals and indices
+	Mesh &mesh;
+	// returned transformed vertices
+	TransformedBuffer &transformedVertexBuffer;
+	// returned transformed normals
+	TransformedBuffer &transformedNormalBuffer;
+	// returned vertex cache statistics
+	VertexCacheStatistics &statistics;
+
+	template <typename Shader>
+	void operator()( Shader const &shader )
+	{
+		if(mesh.shortIndices != nullptr) {
+			run(shader, mesh.shortIndices);
+		} else {
+			run(shader, mesh.indices);
+		}
+	}
+
+	template <typename Shader, typename Index>
+	void run( Shader const &shader, Index const *indices )
+	{
+		std::vector<unsigned char> transformed(mesh.vertexCount, 0);
+
+		for(size_t i = 0; i < mesh.indexCount; i++) {
+			unsigned int index = indices[i];
+			if(transformed[index] == 0) {
+				transformed[index] = 1;
+				transformedVertexBuffer[index] = shader.transformVertex(mesh, index);
+				transformedNormalBuffer[index] = shader.transformNormal(mesh, index);
+			}
+		}
+
+		statistics = simulateVertexCache(indices, mesh.indexCount);
+	}
+} CachedVertexShaderStage;
+
+/**
+ * Packs an RGBA colour into a single 32 bit value. The bytes are laid out in
+ * memory in R, G, B, A order, which is what the image encoder expects, so a
+ * buffer of packed colours can be written to a file as is.
+ * @param  red   red channel
+ * @param  green green channel
+ * @param  blue  blue channel
+ * @param  alpha transparency
+ * @return       packed colour
+ */
+inline uint32_t packColour( unsigned char const red,
+							unsigned char const green,
+							unsigned char const blue,
+							unsigned char const alpha )
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (uint32_t(red) << 24) | (uint32_t(green) << 16) | (uint32_t(blue) << 8) | uint32_t(alpha);
+#else
+	return uint32_t(red) | (uint32_t(green) << 8) | (uint32_t(blue) << 16) | (uint32_t(alpha) << 24);
+#endif
+}
+
+/**
+ * Attributes of a single fragment (covered pixel), interpolated from the
+ * vertices of its triangle
+ */
+typedef struct Fragment {
+	// interpolated surface normal, not normalised
+	float3 normal;
+	// screen pixel coordinates
+	unsigned int x;
+	unsigned int y;
+	// pixel depth (z)
+	float depth;
+} Fragment;
+
+/**
+ * Normalises an interpolated normal
+ * @param  normal interpolated normal
+ * @return        normal of length 1
+ */
+inline float3 normaliseNormal( float3 const normal )
+{
+	float normalLength = std::sqrt( normal.x * normal.x +
+		normal.y * normal.y +
+		normal.z * normal.z );
+
+	float3 normalised;
+	normalised.x = normal.x / normalLength;
+	normalised.y = normal.y / normalLength;
+	normalised.z = normal.z / normalLength;
+	return normalised;
+}
+
+/**
+ * Up to 8 fragments of the same triangle in structure-of-arrays layout, so
+ * the batched fragment shader can load every attribute straight into a
+ * vector register.
+ */
+typedef struct FragmentBatch {
+	static const unsigned int size = 8;
+
+	// barycentric weights of the fragments
+	alignas(32) float weights0[size];
+	alignas(32) float weights1[size];
+	alignas(32) float weights2[size];
+	// index of the fragments' pixels in the frame buffer
+	unsigned int pixels[size];
+	// number of fragments in the batch
+	unsigned int count;
+} FragmentBatch;
+
+/**
+ * The fragment shader calculates the colour of a pixel from its interpolated
+ * attributes.
+ *
+ * Fragment shaders are stateless functors returning a packed RGBA colour.
+ * rasteriseTriangles is instantiated for the shader type, so the shader is
+ * inlined into the pixel loop, and neither of them needs the heap.
  */
-std::vector<unsigned char> runFragmentShader( float3 const normal )
+struct DiffuseFragmentShader {
+	uint32_t operator()( Fragment const &fragment ) const
+	{
+		const float3 lightDirection(0.0f, 0.0f, 1.0f);
+
+		// Interpolation can slightly change the length of the normal, so we normalise it
+		// here to make sure the lighting calculations appear correct.
+		float3 normal = normaliseNormal(fragment.normal);
+
+		// Computing the dot product between the surface normal and a light
+		// direction gives a diffuse-like reflection. It looks more than
+		// good enough for a few static images.
+		float colour = normal.x * lightDirection.x +
+			normal.y * lightDirection.y +
+			normal.z * lightDirection.z;
+
+		// We first scale the colour value from a range between 0 and 1,
+		// to between 0 and 255.
+		// Since single bytes are only able to go between 0 and 255,
+		// we subsequently clamp the colour to lie within that range.
+		unsigned char colourByte = (unsigned char) std::min(255.0f,
+			std::max(colour * 255.0f, 0.0f));
+
+		// The first three channels are red, green, and blue.
+		// The fourth represents transparency.
+		return packColour(colourByte, colourByte, colourByte, 255);
+	}
+
+	/**
+	 * Shades a batch of 8 fragments of one triangle at once. The normals are
+	 * interpolated and normalised here, using a refined reciprocal square root
+	 * instead of a square root and three divisions. The result can differ from
+	 * the scalar shader by one colour level.
+	 * @param setup   triangle the fragments belong to
+	 * @param batch   fragments, all lanes must hold valid weights
+	 * @param colours returned packed colours
+	 */
+	void operator()( TriangleSetup const &setup, FragmentBatch const &batch, uint32_t *colours ) const
+	{
+		const float3 lightDirection(0.0f, 0.0f, 1.0f);
+
+		float8 weight0, weight1, weight2;
+		std::memcpy(&weight0, batch.weights0, sizeof(float8));
+		std::memcpy(&weight1, batch.weights1, sizeof(float8));
+		std::memcpy(&weight2, batch.weights2, sizeof(float8));
+
+		float4 const &n0 = setup.normals[0];
+		float4 const &n1 = setup.normals[1];
+		float4 const &n2 = setup.normals[2];
+
+		float8 normalX = weight0 * n0.x + weight1 * n1.x + weight2 * n2.x;
+		float8 normalY = weight0 * n0.y + weight1 * n1.y + weight2 * n2.y;
+		float8 normalZ = weight0 * n0.z + weight1 * n1.z + weight2 * n2.z;
+
+		float8 inverseLength;
+		rsqrt8(normalX * normalX + normalY * normalY + normalZ * normalZ, inverseLength);
+
+		float8 colour = (normalX * lightDirection.x +
+						 normalY * lightDirection.y +
+						 normalZ * lightDirection.z) * inverseLength * 255.0f;
+
+		// A zero length normal gives NaN, which the scalar shader turns into white
+		float8 const white = {255, 255, 255, 255, 255, 255, 255, 255};
+		select8(colour == colour, colour, white, colour);
+
+		// The saturating packs clamp the colour to 0..255
+		packGreyColours8(colour, colours);
+	}
+};
+
+/**
+ * Colours of every quantised normal direction. When the colour of a fragment
+ * only depends on its normal, as with directional lights, the whole shading
+ * model can be evaluated once per frame for every direction, and the pixels
+ * then only need a table lookup. More expensive lighting models cost the
+ * same per pixel.
+ *
+ * Normals are quantised with the octahedral encoding (see geom.hpp) to bits
+ * bits per axis, so the table has 2^(2 * bits) entries.
+ */
+typedef struct NormalLookupTable {
+	unsigned int bits;
+	std::vector<uint32_t> colours;
+	// colour of a normal of length zero
+	uint32_t invalidColour;
+
+	/**
+	 * Quantises a normal to its index in the table
+	 * @param  normal normal, does not need to be normalised
+	 * @return        index of the normal in the table
+	 */
+	unsigned int index( float3 const normal ) const
+	{
+		float2 encoded = octahedralEncode(normal);
+		float scale = 0.5f * float((1u << bits) - 1);
+		unsigned int u = (unsigned int) (encoded.x * scale + scale + 0.5f);
+		unsigned int v = (unsigned int) (encoded.y * scale + scale + 0.5f);
+		return (v << bits) | u;
+	}
+} NormalLookupTable;
+
+/**
+ * Evaluates a fragment shader for the centre of every quantised normal
+ * direction. The shader may only depend on the normal of the fragment.
+ * @param table  returned lookup table
+ * @param shader fragment shader
+ * @param bits   bits per axis of the quantised normals
+ */
+template <typename FragmentShader>
+void buildNormalLookupTable( NormalLookupTable &table, FragmentShader const &shader, unsigned int bits )
 {
-	std::vector<unsigned char> pixelColour(4);
-	const float3 lightDirection(0.0f, 0.0f, 1.0f);
-
-	// Computing the dot product between the surface normal and a light
-	// direction gives a diffuse-like reflection. It looks more than
-	// good enough for a few static images.
-	float colour = normal.x * lightDirection.x +
-		normal.y * lightDirection.y +
-		normal.z * lightDirection.z;
-
-	// We first scale the colour value from a range between 0 and 1,
-	// to between 0 and 255.
-	// Since single bytes are only able to go between 0 and 255,
-	// we subsequently clamp the colour to lie within that range.
-	unsigned char colourByte = (unsigned char) std::min(255.0f,
-		std::max(colour * 255.0f, 0.0f));
-
-	// And this writes the pixel to the pixelColor vector. The first three
-	// channels are red, green, and blue. The fourth represents transparency.
-	pixelColour.at(0) = colourByte;
-	pixelColour.at(1) = colourByte;
-	pixelColour.at(2) = colourByte;
-	pixelColour.at(3) = 255;
-	// This colour vector is supposed to go into the frame buffer
-	return pixelColour;
+	table.bits = bits;
+	table.colours.resize(size_t(1) << (2 * bits));
+
+	unsigned int side = 1u << bits;
+	float scale = 2.0f / float(side - 1);
+
+	parallelFor(table.colours.size(), [&](size_t begin, size_t end, unsigned int) {
+		for(size_t i = begin; i < end; i++) {
+			float2 encoded = make_float2(float(i % side) * scale - 1.0f, float(i / side) * scale - 1.0f);
+			Fragment fragment;
+			fragment.normal = octahedralDecode(encoded);
+			fragment.x = 0;
+			fragment.y = 0;
+			fragment.depth = 0;
+			table.colours[i] = shader(fragment);
+		}
+	});
+
+	Fragment invalid;
+	invalid.normal = make_float3(0, 0, 0);
+	invalid.x = 0;
+	invalid.y = 0;
+	invalid.depth = 0;
+	table.invalidColour = shader(invalid);
 }
 
+/**
+ * Fragment shader which looks up the colour of the quantised normal in a
+ * table built by buildNormalLookupTable. No square root, division or
+ * lighting calculation is needed per pixel.
+ */
+struct NormalLookupShader {
+	NormalLookupTable const *table;
+
+	uint32_t operator()( Fragment const &fragment ) const
+	{
+		float3 const &normal = fragment.normal;
+		if(!(std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z) > 0)) {
+			return table->invalidColour;
+		}
+		return table->colours[table->index(normal)];
+	}
+};
+
+/**
+ * Fragment shader for scenes with many lights (tiled forward shading). The
+ * point lights which can reach a pixel are looked up in the light list of its
+ * screen tile, built by cullLights before rasterising, so the cost of a
+ * fragment only depends on the number of lights near it.
+ *
+ * The position of the fragment is reconstructed from its pixel coordinates and
+ * depth with the inverse of the MVP matrix, so the rasteriser does not need to
+ * interpolate it.
+ */
+struct TiledLightingShader {
+	std::vector<Light> const *lights;
+	TileLightGrid const *grid;
+	mat4x4 inverseMVP;
+	unsigned int width;
+	unsigned int height;
+
+	/**
+	 * Reconstructs the world space position of a fragment
+	 * @param  fragment fragment
+	 * @return          position of the fragment
+	 */
+	float3 fragmentPosition( Fragment const &fragment ) const
+	{
+		// Undoes convertClippingSpace and the perspective division
+		float4 clip;
+		clip.x = float(fragment.x) / float(width) - 0.5f;
+		clip.y = float(fragment.y) / float(height) - 0.5f;
+		clip.z = fragment.depth;
+		clip.w = 1;
+		float4 position = transformPoint<MatrixClass::General>(inverseMVP, clip);
+		return make_float3(position.x / position.w, position.y / position.w, position.z / position.w);
+	}
+
+	uint32_t operator()( Fragment const &fragment ) const
+	{
+		float3 normal = normaliseNormal(fragment.normal);
+		float3 colour = make_float3(0, 0, 0);
+
+		for(unsigned int i = 0; i < grid->directionalLights.size(); i++) {
+			Light const &light = (*lights)[grid->directionalLights[i]];
+			float diffuse = std::max(0.0f, normal.x * light.direction.x +
+										   normal.y * light.direction.y +
+										   normal.z * light.direction.z);
+			colour.x += diffuse * light.colour.x;
+			colour.y += diffuse * light.colour.y;
+			colour.z += diffuse * light.colour.z;
+		}
+
+		unsigned int tile = grid->tileIndex(fragment.x, fragment.y);
+		unsigned int begin = grid->tileOffsets[tile];
+		unsigned int end = grid->tileOffsets[tile + 1];
+		if(begin != end) {
+			float3 position = fragmentPosition(fragment);
+			for(unsigned int i = begin; i < end; i++) {
+				Light const &light = (*lights)[grid->pointLights[i]];
+				float3 toLight = make_float3(light.position.x - position.x,
+											 light.position.y - position.y,
+											 light.position.z - position.z);
+				float distanceSquared = toLight.x * toLight.x + toLight.y * toLight.y + toLight.z * toLight.z;
+				float radiusSquared = light.radius * light.radius;
+				if(distanceSquared >= radiusSquared || distanceSquared == 0) {
+					continue;
+				}
+				// Smooth falloff which reaches exactly zero at the radius of the light
+				float ratio = distanceSquared / radiusSquared;
+				float window = 1 - ratio * ratio;
+				float attenuation = window * window;
+
+				float distance = std::sqrt(distanceSquared);
+				float diffuse = std::max(0.0f, (normal.x * toLight.x +
+												normal.y * toLight.y +
+												normal.z * toLight.z) / distance);
+				colour.x += diffuse * attenuation * light.colour.x;
+				colour.y += diffuse * attenuation * light.colour.y;
+				colour.z += diffuse * attenuation * light.colour.z;
+			}
+		}
+
+		return packColour((unsigned char) std::min(255.0f, std::max(colour.x * 255.0f, 0.0f)),
+						  (unsigned char) std::min(255.0f, std::max(colour.y * 255.0f, 0.0f)),
+						  (unsigned char) std::min(255.0f, std::max(colour.z * 255.0f, 0.0f)),
+						  255);
+	}
+};
+
 /**
  * interpolates given normals using the barycentric weights
  *
@@ -210,176 +799,1122 @@ float getTrianglePixelDepth( float4 const v0,
 }
 
 /**
- * The main procedure which rasterises all triangles on the framebuffer
- * @param mesh                    Mesh object
- * @param transformedVertexBuffer transformed vertices from the mesh obj
- * @param transformedNormalBuffer transformed normals from the mesh obj
- * @param frameBuffer             frame buffer for the rendered image
- * @param depthBuffer             depth buffer for every pixel on the image
- * @param width                   width of the image
- * @param height                  height of the image
+ * Builds the setup record of a triangle, and culls triangles which can not
+ * cover a single pixel. Culling is conservative: only triangles for which the
+ * rasteriser would reject every pixel anyway are discarded, so the rendered
+ * image does not change.
+ * @param  v0     transformed triangle vertex in clipping space
+ * @param  v1     transformed triangle vertex in clipping space
+ * @param  v2     transformed triangle vertex in clipping space
+ * @param  n0     transformed normal of v0
+ * @param  n1     transformed normal of v1
+ * @param  n2     transformed normal of v2
+ * @param  width  screen width
+ * @param  height screen height
+ * @param  setup  returned triangle setup record
+ * @return        false if the triangle was culled
+ */
+bool setupTriangle( float4 const v0,
+					float4 const v1,
+					float4 const v2,
+					float4 const n0,
+					float4 const n1,
+					float4 const n2,
+					unsigned int const width,
+					unsigned int const height,
+					TriangleSetup &setup )
+{
+	// Depth culling: the pixel depth is a weighted average of the vertex depths,
+	// so it can only pass the z-clipping test if the vertices do not all lie on the
+	// same side of it. The margin absorbs rounding in the barycentric weights.
+	float const depthMargin = 1e-4f;
+	float minZ = std::min(v0.z, std::min(v1.z, v2.z));
+	float maxZ = std::max(v0.z, std::max(v1.z, v2.z));
+	if(minZ > 1 + depthMargin || maxZ < -1 - depthMargin) {
+		return false;
+	}
+
+	setup.vertices[0] = convertClippingSpace(v0, width, height);
+	setup.vertices[1] = convertClippingSpace(v1, width, height);
+	setup.vertices[2] = convertClippingSpace(v2, width, height);
+
+	float4 &s0 = setup.vertices[0];
+	float4 &s1 = setup.vertices[1];
+	float4 &s2 = setup.vertices[2];
+
+	// A triangle without area has a zero denominator in its barycentric weights,
+	// which turns all weights into infinities or NaNs that never pass the coverage test.
+	float area = ((s1.y - s2.y) * (s0.x - s2.x)) + ((s2.x - s1.x) * (s0.y - s2.y));
+	if(!(area != 0) || !std::isfinite(area)) {
+		return false;
+	}
+
+	// Pixel bounding box. The margin keeps pixels on the border which rounding
+	// errors in the barycentric weights could still consider covered.
+	float minX = std::min(s0.x, std::min(s1.x, s2.x));
+	float maxX = std::max(s0.x, std::max(s1.x, s2.x));
+	float minY = std::min(s0.y, std::min(s1.y, s2.y));
+	float maxY = std::max(s0.y, std::max(s1.y, s2.y));
+	float margin = 2 + 1e-4f * std::max(std::max(std::fabs(minX), std::fabs(maxX)),
+									   std::max(std::fabs(minY), std::fabs(maxY)));
+	minX = std::floor(minX - margin);
+	minY = std::floor(minY - margin);
+	maxX = std::ceil(maxX + margin);
+	maxY = std::ceil(maxY + margin);
+
+	if(maxX < 0 || maxY < 0 || minX > float(width - 1) || minY > float(height - 1)) {
+		return false;
+	}
+
+	setup.minX = (unsigned int) std::max(minX, 0.0f);
+	setup.minY = (unsigned int) std::max(minY, 0.0f);
+	setup.maxX = (unsigned int) std::min(maxX, float(width - 1));
+	setup.maxY = (unsigned int) std::min(maxY, float(height - 1));
+
+	setup.normals[0] = n0;
+	setup.normals[1] = n1;
+	setup.normals[2] = n2;
+
+	return true;
+}
+
+/**
+ * Sets up the triangles of an index buffer from the buffers written by the
+ * vertex shader
+ */
+template <typename Index>
+struct IndexedTriangleSetup {
+	// index buffer, of either width
+	Index const *indices;
+	// transformed vertices from the vertex shader
+	TransformedBuffer &transformedVertexBuffer;
+	// transformed normals from the vertex shader
+	TransformedBuffer &transformedNormalBuffer;
+	// width of the image
+	unsigned int width;
+	// height of the image
+	unsigned int height;
+
+	/**
+	 * Appends the setup records of the triangles which are not culled
+	 * @param begin  first triangle
+	 * @param end    one past the last triangle
+	 * @param buffer returned triangle setup records
+	 */
+	void operator()( size_t begin, size_t end, TriangleSetupBuffer &buffer, unsigned int ) const
+	{
+		for(size_t triangleIndex = begin; triangleIndex < end; triangleIndex++) {
+			// As vertices are commonly reused within a model, rendering libraries use an
+			// index buffer which specifies the indices of the vertices in the vertex buffer
+			// which together make up the specific triangle.
+			unsigned int index0 = indices[3 * triangleIndex + 0];
+			unsigned int index1 = indices[3 * triangleIndex + 1];
+			unsigned int index2 = indices[3 * triangleIndex + 2];
+
+			TriangleSetup setup;
+			if(setupTriangle(transformedVertexBuffer[index0], transformedVertexBuffer[index1], transformedVertexBuffer[index2],
+							 transformedNormalBuffer[index0], transformedNormalBuffer[index1], transformedNormalBuffer[index2],
+							 width, height, setup)) {
+				buffer.push_back(setup);
+			}
+		}
+	}
+};
+
+/**
+ * Fused vertex shader and triangle setup. Instead of transforming the whole
+ * vertex buffer up front, every triangle fetches its three vertices through
+ * the index buffer, transforms them, is culled and is emitted as a setup record
+ * straight away. The transformed vertex and normal buffers are never
+ * materialised; each worker keeps its own post-transform vertex cache so
+ * vertices shared by neighbouring triangles are only transformed once.
  */
-void rasteriseTriangles( Mesh &mesh,
-                         std::vector<float4> &transformedVertexBuffer,
-                         std::vector<float4> &transformedNormalBuffer,
-                         std::vector<unsigned char> &frameBuffer,
+template <typename Shader, typename Index>
+struct FusedTriangleSetup {
+	// Mesh object with all vertices, normals and indices
+	Mesh const &mesh;
+	// vertex shader
+	Shader const &shader;
+	// index buffer of the mesh, of either width
+	Index const *indices;
+	// one vertex cache per worker thread, created by the thread on first use
+	std::vector<std::unique_ptr<VertexCache> > &caches;
+	// width of the image
+	unsigned int width;
+	// height of the image
+	unsigned int height;
+
+	/**
+	 * Appends the setup records of the triangles which are not culled
+	 * @param begin  first triangle
+	 * @param end    one past the last triangle
+	 * @param buffer returned triangle setup records
+	 * @param thread index of the worker thread
+	 */
+	void operator()( size_t begin, size_t end, TriangleSetupBuffer &buffer, unsigned int thread ) const
+	{
+		std::unique_ptr<VertexCache> &cache = caches.at(thread);
+		if(!cache) {
+			cache.reset(new VertexCache());
+		}
+
+		for(size_t triangleIndex = begin; triangleIndex < end; triangleIndex++) {
+			float4 positions[3];
+			float4 normals[3];
+			for(unsigned int corner = 0; corner < 3; corner++) {
+				unsigned int index = indices[3 * triangleIndex + corner];
+				bool miss;
+				VertexCacheEntry &entry = cache->lookup(index, miss);
+				if(miss) {
+					entry.position = shader.transformVertex(mesh, index);
+					entry.normal = shader.transformNormal(mesh, index);
+				}
+				// A later corner may evict this entry from the direct-mapped cache
+				positions[corner] = entry.position;
+				normals[corner] = entry.normal;
+			}
+
+			TriangleSetup setup;
+			if(setupTriangle(positions[0], positions[1], positions[2],
+							 normals[0], normals[1], normals[2],
+							 width, height, setup)) {
+				buffer.push_back(setup);
+			}
+		}
+	}
+};
+
+/**
+ * Hands the triangle setup records of a mesh to the rasteriser in batches.
+ * The triangles are set up in rounds of at most triangleSetupBatchSize per
+ * worker thread, in parallel, and every round is rasterised in triangle order
+ * before the next one is set up. The setup buffers are allocated once, so the
+ * memory used does not grow with the number of triangles.
+ */
+template <typename SetupFunction>
+struct TriangleSetupStream {
+	// sets up a range of triangles, with signature
+	// void(size_t begin, size_t end, TriangleSetupBuffer &buffer, unsigned int thread)
+	SetupFunction const &setupTriangles;
+	// number of triangles of the mesh
+	size_t triangleCount;
+	// one setup buffer per worker thread, with room for triangleSetupBatchSize records
+	std::vector<TriangleSetupBuffer> &buffers;
+	// returned number of heap allocations made by the rasteriser, counted
+	// when built with -DCOUNT_ALLOCATIONS (see utilities/allocationCounter.hpp)
+	size_t &rasterAllocations;
+
+	/**
+	 * Sets up all triangles, and calls function(setup) for every triangle
+	 * which is not culled, in triangle order
+	 * @param function callable with signature void(TriangleSetup const &)
+	 */
+	template <typename TriangleFunction>
+	void forEach( TriangleFunction const &function ) const
+	{
+		size_t roundSize = triangleSetupBatchSize * buffers.size();
+		for(size_t roundBegin = 0; roundBegin < triangleCount; roundBegin += roundSize) {
+			size_t roundEnd = std::min(roundBegin + roundSize, triangleCount);
+
+			// A short round may leave some of the threads without triangles
+			for(unsigned int i = 0; i < buffers.size(); i++) {
+				buffers[i].clear();
+			}
+			parallelFor(roundEnd - roundBegin, [&](size_t begin, size_t end, unsigned int thread) {
+				setupTriangles(roundBegin + begin, roundBegin + end, buffers.at(thread), thread);
+			});
+
+			// '\r' returns to the beginning of the current line
+			std::cout << "Rasterising triangle " << roundEnd << "/" << triangleCount << "\r" << std::flush;
+
+#ifdef COUNT_ALLOCATIONS
+			size_t allocationsBefore = threadHeapAllocationCount();
+#endif
+			for(unsigned int chunk = 0; chunk < buffers.size(); chunk++) {
+				for(unsigned int triangleIndex = 0; triangleIndex < buffers[chunk].size(); triangleIndex++) {
+					function(buffers[chunk][triangleIndex]);
+				}
+			}
+#ifdef COUNT_ALLOCATIONS
+			rasterAllocations += threadHeapAllocationCount() - allocationsBefore;
+#endif
+		}
+		// finish the progress output with a new line
+		std::cout << std::endl;
+	}
+};
+
+/**
+ * Tests whether a triangle covers a pixel which passes the depth test, and if
+ * so updates the depth of the pixel.
+ * @param  setup       triangle setup record
+ * @param  depthBuffer depth buffer for every pixel on the image
+ * @param  width       width of the image
+ * @param  x           screen pixel x-coordinate
+ * @param  y           screen pixel y-coordinate
+ * @param  weights     returned barycentric weights of the pixel
+ * @param  pixelDepth  returned depth of the pixel
+ * @return             whether the pixel is visible
+ */
+inline bool coverPixel( TriangleSetup const &setup,
+						std::vector<float> &depthBuffer,
+						unsigned int const width,
+						unsigned int const x,
+						unsigned int const y,
+						float3 &weights,
+						float &pixelDepth )
+{
+	// The triangle setup already converted the vertices to screen pixel coordinates
+	float4 const &vertex0 = setup.vertices[0];
+	float4 const &vertex1 = setup.vertices[1];
+	float4 const &vertex2 = setup.vertices[2];
+
+	// Calculating the barycentric weights of the pixel in relation to the triangle
+	weights = getTriangleBarycentricWeights(vertex0, vertex1, vertex2, x, y);
+
+	// Now we can determine the depth of our pixel
+	pixelDepth = getTrianglePixelDepth(vertex0, vertex1, vertex2, weights.x, weights.y, weights.z);
+
+	// Z-clipping discards pixels too close or too far from the camera
+	if(pixelDepth >= -1 && pixelDepth <= 1) {
+		// The weights have the nice property that if only one is negative, the pixel lies outside the triangle
+		if(weights.x >= 0 && weights.y >= 0 && weights.z >= 0) {
+			//Have we drawn a pixel above the current?
+			if(pixelDepth < depthBuffer[y * width + x]) {
+				// This pixel is going into the frame buffer,
+				// save its depth to skip all next pixels underneath it
+				depthBuffer[y * width + x] = pixelDepth;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * Rasterises a single triangle: finds the pixels it covers which pass the
+ * depth test, updates their depth, and hands them to the given function.
+ * @param setup       triangle setup record
+ * @param depthBuffer depth buffer for every pixel on the image
+ * @param width       width of the image
+ * @param pixel       callable with signature void(unsigned int x, unsigned int y, float3 weights, float depth)
+ */
+template <typename PixelFunction>
+inline void rasteriseTriangle( TriangleSetup const &setup,
+							   std::vector<float> &depthBuffer,
+							   unsigned int width,
+							   PixelFunction &pixel )
+{
+	// We iterate over each pixel the triangle can cover
+	for(unsigned int y = setup.minY; y <= setup.maxY; y++) {
+		for(unsigned int x = setup.minX; x <= setup.maxX; x++) {
+			float3 weights;
+			float pixelDepth;
+			if(coverPixel(setup, depthBuffer, width, x, y, weights, pixelDepth)) {
+				pixel(x, y, weights, pixelDepth);
+			}
+		}
+	}
+}
+
+/**
+ * The main procedure which rasterises all triangles on the framebuffer.
+ * This is the hot path of the renderer, and it does not allocate any memory.
+ * @param setups      triangle setup records (see TriangleSetupStream)
+ * @param frameBuffer frame buffer for the rendered image, packed RGBA
+ * @param depthBuffer depth buffer for every pixel on the image
+ * @param width       width of the image
+ * @param shader      fragment shader
+ */
+template <typename TriangleSetups, typename FragmentShader>
+void rasteriseTriangles( TriangleSetups const &setups,
+                         std::vector<uint32_t> &frameBuffer,
                          std::vector<float> &depthBuffer,
                          unsigned int width,
-                         unsigned int height )
+                         FragmentShader const &shader )
 {
 	// We rasterise one triangle at a time
-	unsigned int triangleCount = mesh.indexCount / 3;
-	for(unsigned int triangleIndex = 0; triangleIndex < triangleCount; triangleIndex++) {
-		// '\r' returns to the beginning of the current line
-		std::cout << "Rasterising triangle " << (triangleIndex + 1) << "/" << triangleCount << "\r" << std::flush;
-
-		// As vertices are commonly reused within a model, rendering libraries use an
-		// index buffer which specifies the indices of the vertices in the vertex buffer
-		// which together make up the specific triangle.
-		unsigned int index0 = mesh.indices[3 * triangleIndex + 0];
-		unsigned int index1 = mesh.indices[3 * triangleIndex + 1];
-		unsigned int index2 = mesh.indices[3 * triangleIndex + 2];
-
-		// We look up those triangles here
-		float4 *vertex0 = new float4(transformedVertexBuffer.at(index0));
-		float4 *vertex1 = new float4(transformedVertexBuffer.at(index1));
-		float4 *vertex2 = new float4(transformedVertexBuffer.at(index2));
-
-		// These triangles are still in so-called "clipping space". We first convert them
-		// to screen pixel coordinates
-		*vertex0 = convertClippingSpace(*vertex0, width, height);
-		*vertex1 = convertClippingSpace(*vertex1, width, height);
-		*vertex2 = convertClippingSpace(*vertex2, width, height);
-
-		// We iterate over each pixel on the screen
-		for(unsigned int y = 0; y < height; y++) {
-			for(unsigned int x = 0; x < width; x++) {
-				//Coordinate of the current pixel in the framebuffer, remember RGBA color code
-				unsigned int pixelBaseCoordinate = 4 * (x + y * width);
-
-				// Calculating the barycentric weights of the pixel in relation to the triangle
-				float weight0 = getTriangleBarycentricWeights(*vertex0, *vertex1, *vertex2, x, y).x;
-				float weight1 = getTriangleBarycentricWeights(*vertex0, *vertex1, *vertex2, x, y).y;
-				float weight2 = getTriangleBarycentricWeights(*vertex0, *vertex1, *vertex2, x, y).z;
-
-				// Now we can determine the depth of our pixel
-				float pixelDepth = getTrianglePixelDepth(*vertex0, *vertex1, *vertex2, weight0, weight1, weight2);
-
-				// Read the normals belonging to each vertex
-				float4 *normal0 = new float4(transformedNormalBuffer.at(index0));
-				float4 *normal1 = new float4(transformedNormalBuffer.at(index1));
-				float4 *normal2 = new float4(transformedNormalBuffer.at(index2));
-
-				// But since a pixel can lie anywhere between the vertices, we compute an approximated normal
-				// at the pixel location by interpolating the ones from the vertices.
-				float3 *interpolatedNormal = new float3();
-				interpolatedNormal->x = interpolateNormals(*normal0, *normal1, *normal2, weight0, weight1, weight2).x;
-				interpolatedNormal->y = interpolateNormals(*normal0, *normal1, *normal2, weight0, weight1, weight2).y;
-				interpolatedNormal->z = interpolateNormals(*normal0, *normal1, *normal2, weight0, weight1, weight2).z;
-
-				// Cleanup
-				delete normal0;
-				delete normal1;
-				delete normal2;
-
-				// This process can slightly change the length, so we normalise it here to make sure the lighting calculations
-				// appear correct.
-				float normalLength = std::sqrt( interpolatedNormal->x * interpolatedNormal->x +
-					interpolatedNormal->y * interpolatedNormal->y +
-					interpolatedNormal->z * interpolatedNormal->z );
-
-				interpolatedNormal->x /= normalLength;
-				interpolatedNormal->y /= normalLength;
-				interpolatedNormal->z /= normalLength;
-
-				// And we can now execute the fragment shader to compute this pixel's colour.
-				std::vector<unsigned char> pixelColour = runFragmentShader(*interpolatedNormal);
-
-				// Cleanup
-				delete interpolatedNormal;
-
-				// Z-clipping discards pixels too close or too far from the camera
-				if(pixelDepth >= -1 && pixelDepth <= 1) {
-					// The weights have the nice property that if only one is negative, the pixel lies outside the triangle
-					if(weight0 >= 0 && weight1 >= 0 && weight2 >= 0) {
-						//Have we drawn a pixel above the current?
-						if(pixelDepth < depthBuffer.at(y * width + x)) {
-							// This pixel is going into the frame buffer,
-							// save its depth to skip all next pixels underneath it
-							depthBuffer.at(y * width + x) = pixelDepth;
-							// Copy the calculated pixel colour into the frame buffer - RGBA
-							for (unsigned int i = 0; i < pixelColour.size(); i++) {
-									frameBuffer.at(pixelBaseCoordinate + i) = pixelColour.at(i);
-							}
+	setups.forEach([&](TriangleSetup const &setup) {
+		auto shadePixel = [&](unsigned int x, unsigned int y, float3 weights, float pixelDepth) {
+			// But since a pixel can lie anywhere between the vertices, we compute an approximated normal
+			// at the pixel location by interpolating the ones from the vertices.
+			float3 interpolatedNormal = interpolateNormals(setup.normals[0], setup.normals[1], setup.normals[2],
+														   weights.x, weights.y, weights.z);
+
+			Fragment fragment;
+			fragment.normal = interpolatedNormal;
+			fragment.x = x;
+			fragment.y = y;
+			fragment.depth = pixelDepth;
+
+			// And we can now execute the fragment shader to compute this pixel's colour.
+			frameBuffer[y * width + x] = shader(fragment);
+		};
+		rasteriseTriangle(setup, depthBuffer, width, shadePixel);
+	});
+}
+
+/**
+ * Same as rasteriseTriangles, but instead of shading every pixel on its own,
+ * the covered pixels of a triangle are collected in batches of 8, which the
+ * shader processes at once with SIMD instructions.
+ * @param setups      triangle setup records (see TriangleSetupStream)
+ * @param frameBuffer frame buffer for the rendered image, packed RGBA
+ * @param depthBuffer depth buffer for every pixel on the image
+ * @param width       width of the image
+ * @param shader      fragment shader with a batch operator()
+ */
+template <typename TriangleSetups, typename FragmentShader>
+void rasteriseTrianglesBatched( TriangleSetups const &setups,
+                                std::vector<uint32_t> &frameBuffer,
+                                std::vector<float> &depthBuffer,
+                                unsigned int width,
+                                FragmentShader const &shader )
+{
+	FragmentBatch batch;
+	uint32_t colours[FragmentBatch::size];
+
+	setups.forEach([&](TriangleSetup const &setup) {
+		// Each pixel is covered at most once by the same triangle, so writing the
+		// colours of a batch later does not change the result.
+		batch.count = 0;
+		auto flushBatch = [&]() {
+			shader(setup, batch, colours);
+			for(unsigned int i = 0; i < batch.count; i++) {
+				frameBuffer[batch.pixels[i]] = colours[i];
+			}
+			batch.count = 0;
+		};
+		auto collectPixel = [&](unsigned int x, unsigned int y, float3 weights, float) {
+			batch.weights0[batch.count] = weights.x;
+			batch.weights1[batch.count] = weights.y;
+			batch.weights2[batch.count] = weights.z;
+			batch.pixels[batch.count] = y * width + x;
+			batch.count++;
+			if(batch.count == FragmentBatch::size) {
+				flushBatch();
+			}
+		};
+		rasteriseTriangle(setup, depthBuffer, width, collectPixel);
+		if(batch.count != 0) {
+			// Unused lanes get valid weights so they do not produce NaNs
+			for(unsigned int i = batch.count; i < FragmentBatch::size; i++) {
+				batch.weights0[i] = 1;
+				batch.weights1[i] = 0;
+				batch.weights2[i] = 0;
+			}
+			flushBatch();
+		}
+	});
+}
+
+/**
+ * Runs the fragment shader at a single point of a triangle, for the shading
+ * modes which do not shade every pixel
+ * @param  normal normal to shade with
+ * @param  vertex screen position to shade at
+ * @param  width  width of the image
+ * @param  height height of the image
+ * @param  shader fragment shader
+ * @return        packed colour
+ */
+template <typename FragmentShader>
+inline uint32_t shadeAt( float3 const normal,
+						 float4 const vertex,
+						 unsigned int const width,
+						 unsigned int const height,
+						 FragmentShader const &shader )
+{
+	// Vertices can lie outside of the screen, but fragments never do
+	Fragment fragment;
+	fragment.normal = normal;
+	fragment.x = (unsigned int) std::min(std::max(vertex.x, 0.0f), float(width - 1));
+	fragment.y = (unsigned int) std::min(std::max(vertex.y, 0.0f), float(height - 1));
+	fragment.depth = std::min(std::max(vertex.z, -1.0f), 1.0f);
+	return shader(fragment);
+}
+
+/**
+ * Gouraud shading: the fragment shader runs once per vertex, and the
+ * rasteriser interpolates the resulting colours instead of the normals.
+ * Highlights which fall between the vertices are lost, in return a pixel
+ * costs no more than a few multiplications.
+ * @param setups      triangle setup records (see TriangleSetupStream)
+ * @param frameBuffer frame buffer for the rendered image, packed RGBA
+ * @param depthBuffer depth buffer for every pixel on the image
+ * @param width       width of the image
+ * @param height      height of the image
+ * @param shader      fragment shader
+ */
+template <typename TriangleSetups, typename FragmentShader>
+void rasteriseTrianglesGouraud( TriangleSetups const &setups,
+                                std::vector<uint32_t> &frameBuffer,
+                                std::vector<float> &depthBuffer,
+                                unsigned int width,
+                                unsigned int height,
+                                FragmentShader const &shader )
+{
+	setups.forEach([&](TriangleSetup const &setup) {
+		// Packed colours are stored in R, G, B, A order, so their bytes can be
+		// interpolated without knowing the byte order of the machine
+		unsigned char vertexColours[3][4];
+		for(unsigned int i = 0; i < 3; i++) {
+			float4 const &n = setup.normals[i];
+			uint32_t colour = shadeAt(make_float3(n.x, n.y, n.z), setup.vertices[i], width, height, shader);
+			std::memcpy(vertexColours[i], &colour, sizeof(colour));
+		}
+
+		auto shadePixel = [&](unsigned int x, unsigned int y, float3 weights, float) {
+			unsigned char channels[4];
+			for(unsigned int c = 0; c < 4; c++) {
+				float value = weights.x * vertexColours[0][c] +
+							  weights.y * vertexColours[1][c] +
+							  weights.z * vertexColours[2][c];
+				channels[c] = (unsigned char) std::min(255.0f, value + 0.5f);
+			}
+			uint32_t colour;
+			std::memcpy(&colour, channels, sizeof(colour));
+			frameBuffer[y * width + x] = colour;
+		};
+		rasteriseTriangle(setup, depthBuffer, width, shadePixel);
+	});
+}
+
+/**
+ * Flat shading: the fragment shader runs once per triangle, with the average
+ * normal of its vertices at its centroid. Every visible pixel of the triangle
+ * gets the same colour, so consecutive pixels on a row are collected in spans,
+ * which are filled at once with wide stores.
+ * @param setups      triangle setup records (see TriangleSetupStream)
+ * @param frameBuffer frame buffer for the rendered image, packed RGBA
+ * @param depthBuffer depth buffer for every pixel on the image
+ * @param width       width of the image
+ * @param height      height of the image
+ * @param shader      fragment shader
+ */
+template <typename TriangleSetups, typename FragmentShader>
+void rasteriseTrianglesFlat( TriangleSetups const &setups,
+                             std::vector<uint32_t> &frameBuffer,
+                             std::vector<float> &depthBuffer,
+                             unsigned int width,
+                             unsigned int height,
+                             FragmentShader const &shader )
+{
+	setups.forEach([&](TriangleSetup const &setup) {
+		float4 const &n0 = setup.normals[0];
+		float4 const &n1 = setup.normals[1];
+		float4 const &n2 = setup.normals[2];
+		float4 const &v0 = setup.vertices[0];
+		float4 const &v1 = setup.vertices[1];
+		float4 const &v2 = setup.vertices[2];
+		float3 normal = make_float3(n0.x + n1.x + n2.x, n0.y + n1.y + n2.y, n0.z + n1.z + n2.z);
+		float4 centroid;
+		centroid.x = (v0.x + v1.x + v2.x) / 3.0f;
+		centroid.y = (v0.y + v1.y + v2.y) / 3.0f;
+		centroid.z = (v0.z + v1.z + v2.z) / 3.0f;
+		centroid.w = 1;
+		uint32_t colour = shadeAt(normal, centroid, width, height, shader);
+
+		// Span of pixels which passed the depth test, [spanBegin, spanEnd) in the frame buffer
+		size_t spanBegin = 0;
+		size_t spanEnd = 0;
+		auto fillSpan = [&]() {
+			std::fill(frameBuffer.begin() + spanBegin, frameBuffer.begin() + spanEnd, colour);
+		};
+		auto collectPixel = [&](unsigned int x, unsigned int y, float3, float) {
+			size_t pixel = size_t(y) * width + x;
+			if(pixel != spanEnd) {
+				fillSpan();
+				spanBegin = pixel;
+			}
+			spanEnd = pixel + 1;
+		};
+		rasteriseTriangle(setup, depthBuffer, width, collectPixel);
+		fillSpan();
+	});
+}
+
+/**
+ * Coarse (variable-rate) shading: the screen is divided into square blocks,
+ * and within a triangle a block is shaded only once when the normal hardly
+ * changes across it. Coverage and depth are still determined per pixel, so
+ * edges stay sharp; only the colour is shared by the pixels of the block.
+ *
+ * The interpolated normal is an affine function of the pixel position:
+ * N(x, y) = N(centre) + dx * gradientX + dy * gradientY. Across a block it
+ * therefore deviates from the normal at the block centre by at most the same
+ * vector length d everywhere in the triangle, and the angle between them stays
+ * below the threshold when d <= sin(threshold) * |N(centre)|. Testing a block
+ * only costs the normal at its centre.
+ * @param setups      triangle setup records (see TriangleSetupStream)
+ * @param frameBuffer frame buffer for the rendered image, packed RGBA
+ * @param depthBuffer depth buffer for every pixel on the image
+ * @param width       width of the image
+ * @param blockSize   width and height of the blocks, 2 or 4
+ * @param threshold   largest angle in degrees between the normals of a block shaded once
+ * @param shader      fragment shader
+ */
+template <typename TriangleSetups, typename FragmentShader>
+void rasteriseTrianglesCoarse( TriangleSetups const &setups,
+                               std::vector<uint32_t> &frameBuffer,
+                               std::vector<float> &depthBuffer,
+                               unsigned int width,
+                               unsigned int blockSize,
+                               float threshold,
+                               FragmentShader const &shader )
+{
+	static const unsigned int maxBlockSize = 4;
+	if(blockSize < 2 || blockSize > maxBlockSize) {
+		throw std::runtime_error("Coarse shading supports blocks of 2x2 or 4x4 pixels.");
+	}
+	float const sine = std::sin(std::min(threshold, 90.0f) * 3.14159265f / 180.0f);
+	float const sineSquared = sine * sine;
+	float const halfBlock = 0.5f * float(blockSize - 1);
+
+	// Visible pixels of the current block
+	unsigned int blockPixelCount;
+	unsigned int blockPixels[maxBlockSize * maxBlockSize];
+	float3 blockWeights[maxBlockSize * maxBlockSize];
+	float blockDepths[maxBlockSize * maxBlockSize];
+
+	size_t blockCount = 0;
+	size_t coarseBlockCount = 0;
+
+	setups.forEach([&](TriangleSetup const &setup) {
+		float4 const &v0 = setup.vertices[0];
+		float4 const &v1 = setup.vertices[1];
+		float4 const &v2 = setup.vertices[2];
+		float4 const &n0 = setup.normals[0];
+		float4 const &n1 = setup.normals[1];
+		float4 const &n2 = setup.normals[2];
+
+		// Screen space gradients of the interpolated normal
+		float3 originWeights = getTriangleBarycentricWeights(v0, v1, v2, setup.minX, setup.minY);
+		float3 rightWeights = getTriangleBarycentricWeights(v0, v1, v2, setup.minX + 1, setup.minY);
+		float3 downWeights = getTriangleBarycentricWeights(v0, v1, v2, setup.minX, setup.minY + 1);
+		float3 origin = interpolateNormals(n0, n1, n2, originWeights.x, originWeights.y, originWeights.z);
+		float3 right = interpolateNormals(n0, n1, n2, rightWeights.x, rightWeights.y, rightWeights.z);
+		float3 down = interpolateNormals(n0, n1, n2, downWeights.x, downWeights.y, downWeights.z);
+		float3 gradientX = make_float3(right.x - origin.x, right.y - origin.y, right.z - origin.z);
+		float3 gradientY = make_float3(down.x - origin.x, down.y - origin.y, down.z - origin.z);
+
+		// Largest deviation from the centre normal within a block, reached at its corners
+		float3 diagonal = make_float3(gradientX.x + gradientY.x, gradientX.y + gradientY.y, gradientX.z + gradientY.z);
+		float3 antiDiagonal = make_float3(gradientX.x - gradientY.x, gradientX.y - gradientY.y, gradientX.z - gradientY.z);
+		float deviationSquared = halfBlock * halfBlock * std::max(
+			diagonal.x * diagonal.x + diagonal.y * diagonal.y + diagonal.z * diagonal.z,
+			antiDiagonal.x * antiDiagonal.x + antiDiagonal.y * antiDiagonal.y + antiDiagonal.z * antiDiagonal.z);
+		// Degenerate normals give NaN gradients, those triangles are shaded per pixel
+		bool smooth = std::isfinite(deviationSquared);
+
+		// Blocks are aligned to the screen, not to the triangle
+		for(unsigned int blockY = setup.minY - setup.minY % blockSize; blockY <= setup.maxY; blockY += blockSize) {
+			for(unsigned int blockX = setup.minX - setup.minX % blockSize; blockX <= setup.maxX; blockX += blockSize) {
+				blockPixelCount = 0;
+				unsigned int endY = std::min(blockY + blockSize - 1, setup.maxY);
+				unsigned int endX = std::min(blockX + blockSize - 1, setup.maxX);
+				for(unsigned int y = std::max(blockY, setup.minY); y <= endY; y++) {
+					for(unsigned int x = std::max(blockX, setup.minX); x <= endX; x++) {
+						float3 weights;
+						float pixelDepth;
+						if(coverPixel(setup, depthBuffer, width, x, y, weights, pixelDepth)) {
+							blockPixels[blockPixelCount] = y * width + x;
+							blockWeights[blockPixelCount] = weights;
+							blockDepths[blockPixelCount] = pixelDepth;
+							blockPixelCount++;
 						}
 					}
 				}
+				if(blockPixelCount == 0) {
+					continue;
+				}
+				blockCount++;
+
+				bool uniform = false;
+				float3 centre;
+				if(smooth && blockPixelCount > 1) {
+					float dx = float(blockX) + halfBlock - float(setup.minX);
+					float dy = float(blockY) + halfBlock - float(setup.minY);
+					centre.x = origin.x + dx * gradientX.x + dy * gradientY.x;
+					centre.y = origin.y + dx * gradientX.y + dy * gradientY.y;
+					centre.z = origin.z + dx * gradientX.z + dy * gradientY.z;
+					uniform = deviationSquared <= sineSquared * (centre.x * centre.x + centre.y * centre.y + centre.z * centre.z);
+				}
+
+				if(uniform) {
+					// One fragment, at the first visible pixel, colours the whole block
+					Fragment fragment;
+					fragment.normal = centre;
+					fragment.x = blockPixels[0] % width;
+					fragment.y = blockPixels[0] / width;
+					fragment.depth = blockDepths[0];
+					uint32_t colour = shader(fragment);
+					for(unsigned int i = 0; i < blockPixelCount; i++) {
+						frameBuffer[blockPixels[i]] = colour;
+					}
+					coarseBlockCount++;
+				} else {
+					for(unsigned int i = 0; i < blockPixelCount; i++) {
+						float3 const &weights = blockWeights[i];
+						Fragment fragment;
+						fragment.normal = interpolateNormals(n0, n1, n2, weights.x, weights.y, weights.z);
+						fragment.x = blockPixels[i] % width;
+						fragment.y = blockPixels[i] / width;
+						fragment.depth = blockDepths[i];
+						frameBuffer[blockPixels[i]] = shader(fragment);
+					}
+				}
 			}
 		}
-		// Cleanup
-		delete vertex0;
-		delete vertex1;
-		delete vertex2;
+	});
+
+	std::cout << "Coarse shading: " << coarseBlockCount << " of " << blockCount << " blocks shaded once ("
+			  << (blockCount == 0 ? 0.0f : 100.0f * float(coarseBlockCount) / float(blockCount)) << "%)" << std::endl;
+}
+
+/**
+ * Rasterises the triangles with the given fragment shader, in the shading mode
+ * selected by the render options
+ * @param options     render options
+ * @param setups      triangle setup records (see TriangleSetupStream)
+ * @param frameBuffer frame buffer for the rendered image, packed RGBA
+ * @param depthBuffer depth buffer for every pixel on the image
+ * @param width       width of the image
+ * @param height      height of the image
+ * @param shader      fragment shader
+ */
+template <typename TriangleSetups, typename FragmentShader>
+void rasteriseTrianglesShaded( RenderOptions const &options,
+                               TriangleSetups const &setups,
+                               std::vector<uint32_t> &frameBuffer,
+                               std::vector<float> &depthBuffer,
+                               unsigned int width,
+                               unsigned int height,
+                               FragmentShader const &shader )
+{
+	switch(options.shading) {
+	case ShadingMode::Gouraud:
+		rasteriseTrianglesGouraud(setups, frameBuffer, depthBuffer, width, height, shader);
+		break;
+	case ShadingMode::Flat:
+		rasteriseTrianglesFlat(setups, frameBuffer, depthBuffer, width, height, shader);
+		break;
+	default:
+		if(options.coarseShadingBlock != 0) {
+			rasteriseTrianglesCoarse(setups, frameBuffer, depthBuffer, width,
+									 options.coarseShadingBlock, options.coarseShadingThreshold, shader);
+		} else {
+			rasteriseTriangles(setups, frameBuffer, depthBuffer, width, shader);
+		}
+		break;
 	}
-	// finish the progress output with a new line
-	std::cout << std::endl;
 }
 
 /**
- * Procedure to kick of the rasterisation process
- * @param mesh            Mesh object
- * @param outputImageFile path of the output image
- * @param width           width of the output image
- * @param height          height of the output image
+ * Prints the vertex cache statistics of a mesh
+ * @param statistics vertex cache statistics
  */
-void rasterise(Mesh mesh, std::string outputImageFile, unsigned int width, unsigned int height) {
-	// We first need to allocate some buffers.
+void printVertexCacheStatistics( VertexCacheStatistics statistics )
+{
+	std::cout << "Vertex cache: " << statistics.misses << "/" << statistics.references << " misses"
+			  << " (miss ratio " << statistics.missRatio()
+			  << ", ACMR " << statistics.averageCacheMissRatio() << ")" << std::endl;
+}
 
-	// The framebuffer contains the image being rendered.
-	std::vector<unsigned char> frameBuffer;
-	frameBuffer.resize(width * height * 4, 0);
+/**
+ * Creates a mesh which draws other triangles with the vertices of a mesh. The
+ * view does not own any of its arrays, and must not outlive the mesh.
+ * @param  mesh         Mesh object
+ * @param  indices      32-bit index buffer of the triangles, or null
+ * @param  shortIndices 16-bit index buffer of the triangles, or null
+ * @param  indexCount   length of the index buffer
+ * @return              the view
+ */
+Mesh meshView( Mesh const &mesh, unsigned int *indices, uint16_t *shortIndices, size_t indexCount )
+{
+	Mesh view;
+	view.vertices = mesh.vertices;
+	view.normals = mesh.normals;
+	view.streams = mesh.streams;
+	view.quantisedVertices = mesh.quantisedVertices;
+	view.quantisationOffset = mesh.quantisationOffset;
+	view.quantisationScale = mesh.quantisationScale;
+	view.indices = indices;
+	view.shortIndices = shortIndices;
+	view.vertexCount = mesh.vertexCount;
+	view.normalCount = mesh.normalCount;
+	view.indexCount = indexCount;
+	return view;
+}
 
+/**
+ * Picks the coarsest level of detail of a mesh whose error still projects to
+ * at most the given number of pixels. The error is scaled by the size of a
+ * unit at the centre of the bounding sphere of the mesh.
+ * @param  mesh       Mesh object with levels of detail
+ * @param  MVP        matrix transforming the mesh to clipping space
+ * @param  width      width of the image
+ * @param  height     height of the image
+ * @param  pixelError largest error in pixels
+ * @param  pixelsPerUnit returned pixels per unit of the mesh
+ * @return            level of detail, 0 is the mesh itself
+ */
+unsigned int selectLevelOfDetail( Mesh const &mesh,
+								  mat4x4 const &MVP,
+								  unsigned int width,
+								  unsigned int height,
+								  float pixelError,
+								  float &pixelsPerUnit )
+{
+	pixelsPerUnit = 0;
+	if (mesh.lods.empty() || mesh.vertexCount == 0) {
+		return 0;
+	}
+
+	float3 lower;
+	float3 upper;
+	computeBounds(mesh, lower, upper);
+	float3 centre = (lower + upper) / 2;
+	float radius = 0.5f * length(upper - lower);
+
+	// w grows with the distance from the camera, the screen size of a unit
+	// shrinks with it. A camera within the bounding sphere sees the full mesh.
+	float wScale = length(make_float3(MVP.m30, MVP.m31, MVP.m32));
+	float centreW = MVP.m30 * centre.x + MVP.m31 * centre.y + MVP.m32 * centre.z + MVP.m33;
+	if (!(centreW > radius * wScale)) {
+		return 0;
+	}
+	pixelsPerUnit = std::max(float(width) * length(make_float3(MVP.m00, MVP.m01, MVP.m02)),
+							 float(height) * length(make_float3(MVP.m10, MVP.m11, MVP.m12))) / centreW;
+
+	unsigned int level = 0;
+	for (unsigned int i = 0; i < mesh.lods.size(); i++) {
+		if (mesh.lods[i].error * pixelsPerUnit <= pixelError) {
+			level = i + 1;
+		}
+	}
+	return level;
+}
+
+/**
+ * Prints how many meshlets and triangles cluster culling rejected
+ * @param statistics cluster culling statistics
+ */
+void printClusterCullingStatistics( ClusterCullingStatistics statistics )
+{
+	std::cout << "Cluster culling: " << statistics.frustumCulled + statistics.backfaceCulled << "/" << statistics.meshlets << " meshlets culled"
+			  << " (" << statistics.frustumCulled << " outside the frustum, " << statistics.backfaceCulled << " back-facing), "
+			  << statistics.visibleTriangles << "/" << statistics.triangles << " triangles left" << std::endl;
+}
+
+/**
+ * Everything that stays the same for all draw calls of a frame: the buffers
+ * being rendered to, the matrices, the lights, and the shading path chosen
+ * from the render options.
+ */
+struct FrameState {
+	RenderOptions options;
+	unsigned int width;
+	unsigned int height;
+
+	// The framebuffer contains the image being rendered, one packed RGBA colour per pixel
+	std::vector<uint32_t> frameBuffer;
 	// The depth buffer is used to make sure that objects closer to the camera occlude/obscure objects that are behind it
 	std::vector<float> depthBuffer;
-	depthBuffer.resize(width * height, 1);
-
-	// And these two buffers store vertices and normals processed by the vertex shader.
-	std::vector<float4> transformedVertexBuffer;
-	transformedVertexBuffer.resize(mesh.vertexCount);
-
-	std::vector<float4> transformedNormalBuffer;
-	transformedNormalBuffer.resize(mesh.vertexCount);
-
-	// Initializing the framebuffer with RGBA (0,0,0,255), black, no
-	// transparency
-	for (unsigned int i = 0; i < 4; i++) {
-		for (unsigned int y = 0; y < height; y++) {
-			for(unsigned int x = 0; x < width; x++) {
-				frameBuffer.at(4 * ( x + y * width ) + i) = 0;
-				if ( i == 3 ) {
-					//Transparency
-					frameBuffer.at(4 * ( x + y * width ) + i) = 255;
-				}
+
+	VertexShaderMatrices matrices;
+
+	bool tiledLighting;
+	TileLightGrid lightGrid;
+	TiledLightingShader tiledLightingShader;
+
+	bool normalLookup;
+	NormalLookupTable normalLookupTable;
+
+	bool simdShading;
+
+	// One triangle setup buffer per worker thread, reused for every batch of
+	// triangles (see TriangleSetupStream)
+	std::vector<TriangleSetupBuffer> setupBuffers;
+};
+
+Renderer::Renderer(unsigned int width, unsigned int height, RenderOptions const &options)
+{
+	state.reset(new FrameState());
+	FrameState &frame = *state;
+	frame.options = options;
+	frame.width = width;
+	frame.height = height;
+
+	// We first need to allocate some buffers.
+
+	// The framebuffer is initialised to (0,0,0,255): black, no transparency.
+	frame.frameBuffer.resize(width * height, packColour(0, 0, 0, 255));
+	frame.depthBuffer.resize(width * height, 1);
+	frame.setupBuffers.resize(workerThreadCount());
+	for (unsigned int i = 0; i < frame.setupBuffers.size(); i++) {
+		frame.setupBuffers[i].reserve(triangleSetupBatchSize);
+	}
+
+	frame.matrices = getVertexShaderMatrices();
+
+	// Without a light file the scene is lit by the single light of DiffuseFragmentShader
+	std::vector<Light> const &lights = frame.options.lights;
+	frame.tiledLighting = !lights.empty();
+	if (frame.tiledLighting) {
+		frame.lightGrid = cullLights(lights, frame.matrices.MVP, width, height);
+		frame.tiledLightingShader = TiledLightingShader{&lights, &frame.lightGrid, inverse(frame.matrices.MVP), width, height};
+		std::cout << "Light culling: " << lights.size() << " lights, "
+				  << float(frame.lightGrid.pointLights.size()) / float(frame.lightGrid.tileOffsets.size() - 1)
+				  << " point lights per tile on average" << std::endl;
+	}
+
+	// A lookup table can only replace shading which depends on the normal alone
+	frame.normalLookup = options.normalLookupBits != 0;
+	if (frame.normalLookup && frame.tiledLighting && frame.lightGrid.directionalLights.size() != lights.size()) {
+		std::cout << "Point lights depend on the fragment position, ignoring --normal-lut" << std::endl;
+		frame.normalLookup = false;
+	}
+	frame.simdShading = options.simdShading && !frame.normalLookup;
+	if (frame.simdShading && frame.tiledLighting) {
+		std::cout << "The SIMD shader only supports the default light, ignoring --simd-shading" << std::endl;
+		frame.simdShading = false;
+	}
+	if (frame.simdShading && (options.shading != ShadingMode::Phong || options.coarseShadingBlock != 0)) {
+		std::cout << "The SIMD shader shades every pixel, ignoring --simd-shading" << std::endl;
+		frame.simdShading = false;
+	}
+	if (options.coarseShadingBlock != 0 && options.shading != ShadingMode::Phong) {
+		std::cout << "Coarse shading only applies to phong shading, ignoring --coarse-shading" << std::endl;
+	}
+
+	// The lookup table depends on the lights, so it is rebuilt every frame
+	if (frame.normalLookup) {
+		if (frame.tiledLighting) {
+			buildNormalLookupTable(frame.normalLookupTable, frame.tiledLightingShader, options.normalLookupBits);
+		} else {
+			buildNormalLookupTable(frame.normalLookupTable, DiffuseFragmentShader(), options.normalLookupBits);
+		}
+	}
+}
+
+Renderer::~Renderer()
+{
+}
+
+/**
+ * Rasterises the triangles of a draw call in the shading path chosen for the
+ * frame. The triangles are set up in batches as they are rasterised (see
+ * TriangleSetupStream), into the setup buffers of the frame.
+ */
+typedef struct FrameRasteriser {
+	FrameState &frame;
+	// number of heap allocations made by the rasteriser so far, counted when
+	// built with -DCOUNT_ALLOCATIONS
+	size_t rasterAllocations;
+
+	/**
+	 * Sets up and rasterises a number of triangles
+	 * @param setupTriangles sets up a range of triangles (see TriangleSetupStream)
+	 * @param triangleCount  number of triangles
+	 */
+	template <typename SetupFunction>
+	void operator()( SetupFunction const &setupTriangles, size_t triangleCount )
+	{
+		RenderOptions const &options = frame.options;
+		TriangleSetupStream<SetupFunction> setups = {setupTriangles, triangleCount, frame.setupBuffers, rasterAllocations};
+
+		if (frame.normalLookup) {
+			rasteriseTrianglesShaded(options, setups, frame.frameBuffer, frame.depthBuffer, frame.width, frame.height, NormalLookupShader{&frame.normalLookupTable});
+		} else if (frame.simdShading) {
+			rasteriseTrianglesBatched(setups, frame.frameBuffer, frame.depthBuffer, frame.width, DiffuseFragmentShader());
+		} else if (frame.tiledLighting) {
+			rasteriseTrianglesShaded(options, setups, frame.frameBuffer, frame.depthBuffer, frame.width, frame.height, frame.tiledLightingShader);
+		} else {
+			rasteriseTrianglesShaded(options, setups, frame.frameBuffer, frame.depthBuffer, frame.width, frame.height, DiffuseFragmentShader());
+		}
+	}
+} FrameRasteriser;
+
+/**
+ * Fused vertex shader, triangle setup and rasterisation (see FusedTriangleSetup)
+ */
+typedef struct FusedTriangleSetupStage {
+	// Mesh object with all vertices, normals and indices
+	Mesh &mesh;
+	// width of the image
+	unsigned int width;
+	// height of the image
+	unsigned int height;
+	// rasterises the triangle setup records
+	FrameRasteriser &rasteriser;
+	// returned vertex cache statistics
+	VertexCacheStatistics &statistics;
+
+	template <typename Shader>
+	void operator()( Shader const &shader )
+	{
+		if (mesh.shortIndices != nullptr) {
+			run(shader, mesh.shortIndices);
+		} else {
+			run(shader, mesh.indices);
+		}
+	}
+
+	template <typename Shader, typename Index>
+	void run( Shader const &shader, Index const *indices )
+	{
+		// The caches are kept from one batch to the next
+		std::vector<std::unique_ptr<VertexCache> > caches(workerThreadCount());
+		FusedTriangleSetup<Shader, Index> setupTriangles = {mesh, shader, indices, caches, width, height};
+		rasteriser(setupTriangles, mesh.indexCount / 3);
+
+		for (unsigned int i = 0; i < caches.size(); i++) {
+			if (caches[i]) {
+				statistics.add(caches[i]->statistics);
+			}
+		}
+	}
+} FusedTriangleSetupStage;
+
+void Renderer::draw(Mesh &mesh)
+{
+	FrameState &frame = *state;
+	RenderOptions const &options = frame.options;
+	unsigned int width = frame.width;
+	unsigned int height = frame.height;
+
+	// A level of detail, and the triangles left after cluster culling, are
+	// drawn as meshes of their own which share the vertices of the mesh
+	Mesh levelMesh;
+	bool coarserLevel = false;
+	if (!mesh.lods.empty()) {
+		unsigned int level = std::min(options.levelOfDetail, (unsigned int) mesh.lods.size());
+		float pixelsPerUnit = 0;
+		if (options.automaticLevelOfDetail) {
+			level = selectLevelOfDetail(mesh, frame.matrices.MVP, width, height, options.lodPixelError, pixelsPerUnit);
+		}
+		std::cout << "Level of detail: " << level << " of " << mesh.lods.size();
+		if (level != 0) {
+			MeshLOD const &lod = mesh.lods[level - 1];
+			if (mesh.shortLodIndices != nullptr) {
+				levelMesh = meshView(mesh, nullptr, mesh.shortLodIndices + lod.indexOffset, lod.indexCount);
+			} else {
+				levelMesh = meshView(mesh, mesh.lodIndices + lod.indexOffset, nullptr, lod.indexCount);
 			}
+			coarserLevel = true;
+			std::cout << " (" << lod.indexCount / 3 << "/" << mesh.indexCount / 3 << " triangles, error " << lod.error;
+			if (options.automaticLevelOfDetail) {
+				std::cout << " = " << lod.error * pixelsPerUnit << " pixels";
+			}
+			std::cout << ")";
 		}
+		std::cout << std::endl;
 	}
+	Mesh &levelOrMesh = coarserLevel ? levelMesh : mesh;
 
-	std::cout << "Running the vertex shader... ";
+	Mesh culledMesh;
+	std::vector<unsigned int> culledIndices;
+	std::vector<unsigned char> vertexMask;
+	bool clusterCulling = options.clusterCulling != ClusterCulling::Off;
+	if (clusterCulling) {
+		std::cout << "Running cluster culling... ";
+		std::vector<Meshlet> meshlets = buildMeshlets(levelOrMesh);
+		ClusterCullingStatistics statistics = cullMeshlets(meshlets, levelOrMesh, frame.matrices.MVP, options.clusterCulling, culledIndices, vertexMask);
+		std::cout << "complete!" << std::endl;
+		printClusterCullingStatistics(statistics);
+		culledMesh = meshView(levelOrMesh, culledIndices.data(), nullptr, culledIndices.size());
+	}
+	Mesh &drawnMesh = clusterCulling ? culledMesh : levelOrMesh;
+	if (coarserLevel && !clusterCulling) {
+		vertexMask.assign(mesh.vertexCount, 0);
+		for (size_t i = 0; i < drawnMesh.indexCount; i++) {
+			vertexMask[drawnMesh.index(i)] = 1;
+		}
+	}
 
-	runVertexShader(mesh, transformedVertexBuffer, transformedNormalBuffer);
+	FrameRasteriser rasteriser = {frame, 0};
 
-	std::cout << "complete!" << std::endl;
+	if (options.fusedPipeline) {
+		std::cout << "Running the fused vertex shader, triangle setup and rasteriser..." << std::endl;
+		VertexCacheStatistics statistics;
+		FusedTriangleSetupStage stage = {drawnMesh, width, height, rasteriser, statistics};
+		dispatchVertexShader(frame.matrices, drawnMesh, stage);
+		printVertexCacheStatistics(statistics);
+	} else {
+		// These two buffers store vertices and normals processed by the vertex shader.
+		// Their contents are only written by the (parallel) vertex shader.
+		TransformedBuffer transformedVertexBuffer;
+		transformedVertexBuffer.resize(drawnMesh.vertexCount);
 
-	rasteriseTriangles(mesh, transformedVertexBuffer, transformedNormalBuffer, frameBuffer, depthBuffer, width, height);
+		TransformedBuffer transformedNormalBuffer;
+		transformedNormalBuffer.resize(drawnMesh.vertexCount);
+
+		std::cout << "Running the vertex shader... ";
+
+		if (options.vertexCache) {
+			VertexCacheStatistics statistics;
+			CachedVertexShaderStage stage = {drawnMesh, transformedVertexBuffer, transformedNormalBuffer, statistics};
+			dispatchVertexShader(frame.matrices, drawnMesh, stage);
+			std::cout << "complete!" << std::endl;
+			printVertexCacheStatistics(statistics);
+		} else {
+			// Vertices which are not drawn, because of culling or because of
+			// the level of detail, are skipped
+			VertexShaderStage stage = {drawnMesh, transformedVertexBuffer, transformedNormalBuffer,
+									   vertexMask.empty() ? nullptr : vertexMask.data()};
+			dispatchVertexShader(frame.matrices, drawnMesh, stage);
+			std::cout << "complete!" << std::endl;
+		}
+
+		if (drawnMesh.shortIndices != nullptr) {
+			IndexedTriangleSetup<uint16_t> setupTriangles = {drawnMesh.shortIndices, transformedVertexBuffer, transformedNormalBuffer, width, height};
+			rasteriser(setupTriangles, drawnMesh.indexCount / 3);
+		} else {
+			IndexedTriangleSetup<unsigned int> setupTriangles = {drawnMesh.indices, transformedVertexBuffer, transformedNormalBuffer, width, height};
+			rasteriser(setupTriangles, drawnMesh.indexCount / 3);
+		}
+	}
+
+#ifdef COUNT_ALLOCATIONS
+	// Built with -DCOUNT_ALLOCATIONS, every call to the global operator new is
+	// counted (see utilities/allocationCounter.hpp) to check that the pixel loop
+	// never touches the heap. Only the triangles are counted, not their setup;
+	// only this thread rasterises, while a streaming loader may be allocating
+	// on another one.
+	std::cout << "Heap allocations while rasterising: " << rasteriser.rasterAllocations << std::endl;
+	if (rasteriser.rasterAllocations != 0) {
+		throw std::runtime_error("The rasteriser allocated memory on the heap.");
+	}
+#endif
+}
+
+void Renderer::writeImage(std::string const &outputImageFile)
+{
+	FrameState &frame = *state;
 
 	std::cout << "Finished rendering!" << std::endl;
 
 	std::cout << "Writing image to '" << outputImageFile << "'..." << std::endl;
 
-	unsigned error = lodepng::encode(outputImageFile, frameBuffer, width, height);
+	unsigned error = lodepng::encode(outputImageFile, reinterpret_cast<unsigned char *>(frame.frameBuffer.data()), frame.width, frame.height);
 
 	if(error)
 	{
 		std::cout << "An error occurred while writing the image file: " << error << ": " << lodepng_error_text(error) << std::endl;
 	}
-}
\ No newline at end of file
+}
+
+/**
+ * Procedure to kick of the rasterisation process
+ * @param mesh            Mesh object
+ * @param outputImageFile path of the output image
+ * @param width           width of the output image
+ * @param height          height of the output image
+ * @param options         render options
+ */
+void rasterise(Mesh &mesh, std::string outputImageFile, unsigned int width, unsigned int height, RenderOptions const &options) {
+	Renderer renderer(width, height, options);
+	renderer.draw(mesh);
+	renderer.writeImage(outputImageFile);
+}
@@ -1,6 +1,102 @@
 #pragma once
 
+#include <memory>
 #include <string>
+#include <vector>
+#include "lights.hpp"
+#include "meshlets.hpp"
 #include "utilities/OBJLoader.hpp"
 
-void rasterise(Mesh mesh, std::string outputImageFile, unsigned int width, unsigned int height);
\ No newline at end of file
+// Where the fragment shader runs
+enum class ShadingMode {
+	// once per pixel, with the interpolated normal
+	Phong,
+	// once per vertex, the colours are interpolated
+	Gouraud,
+	// once per triangle
+	Flat
+};
+
+typedef struct RenderOptions {
+	// Transform the referenced vertices lazily, once each, and report the
+	// statistics of a simulated post-transform vertex cache
+	bool vertexCache;
+	// Transform, cull and set up triangles in a single streaming pass
+	bool fusedPipeline;
+	// Shade fragments in batches of 8 with SIMD instructions
+	bool simdShading;
+	// Shade with a lookup table indexed by the quantised normal, with this many
+	// bits per axis. 0 shades every pixel.
+	unsigned int normalLookupBits;
+	// Lights of the scene, shaded with per-tile light lists. Without lights the
+	// scene is lit by a single directional light pointing along the z axis.
+	std::vector<Light> lights;
+	// How often the fragment shader runs
+	ShadingMode shading;
+	// Shade blocks of this many pixels squared only once when their normals are
+	// within coarseShadingThreshold degrees of each other. 0 shades every pixel.
+	unsigned int coarseShadingBlock;
+	float coarseShadingThreshold;
+	// Split meshes into meshlets and reject the meshlets which can not be seen
+	// before the vertex stage (see meshlets.hpp)
+	ClusterCulling clusterCulling;
+	// Level of detail drawn of meshes which have levels of detail, 0 is the
+	// full mesh. Levels past the coarsest draw the coarsest.
+	unsigned int levelOfDetail;
+	// Instead pick the coarsest level whose error, projected onto the screen,
+	// is at most lodPixelError pixels
+	bool automaticLevelOfDetail;
+	float lodPixelError;
+
+	RenderOptions() {
+		vertexCache = false;
+		fusedPipeline = false;
+		simdShading = false;
+		normalLookupBits = 0;
+		shading = ShadingMode::Phong;
+		coarseShadingBlock = 0;
+		coarseShadingThreshold = 1.0f;
+		clusterCulling = ClusterCulling::Off;
+		levelOfDetail = 0;
+		automaticLevelOfDetail = false;
+		lodPixelError = 1.0f;
+	}
+} RenderOptions;
+
+struct FrameState;
+
+/**
+ * Renders an image with any number of draw calls. Every draw call rasterises
+ * a mesh on top of what the earlier ones drew, so a scene can be drawn in
+ * parts, such as the batches of a mesh which is still being loaded.
+ */
+typedef struct Renderer {
+	/**
+	 * Sets up the image and everything the draw calls share
+	 * @param width   width of the image
+	 * @param height  height of the image
+	 * @param options render options
+	 */
+	Renderer(unsigned int width, unsigned int height, RenderOptions const &options);
+	~Renderer();
+
+	/**
+	 * Runs the vertex shader over a mesh and rasterises its triangles
+	 * @param mesh Mesh object
+	 */
+	void draw(Mesh &mesh);
+
+	/**
+	 * Writes the image drawn so far
+	 * @param outputImageFile path of the output image
+	 */
+	void writeImage(std::string const &outputImageFile);
+
+private:
+	Renderer(Renderer const &);
+	Renderer &operator=(Renderer const &);
+
+	std::unique_ptr<FrameState> state;
+} Renderer;
+
+void rasterise(Mesh &mesh, std::string outputImageFile, unsigned int width, unsigned int height, RenderOptions const &options);
\ No newline at end of file
@@ -30,7 +30,7 @@ void sse_test(Mesh &mesh) {
 
     std::cout << "SSE_TEST: Initializing vectors... " << std::flush;
     for (unsigned int i=0; i < vertices.size(); i++) {
-        vertices[i] = mesh.vertices[i];
+        vertices[i] = mesh.position(i);
         rand1.push_back(randFloat4());
         rand2.push_back(randFloat4());
         rand3.push_back(randFloat4());
@@ -2,9 +2,11 @@
 #include "utilities/OBJLoader.hpp"
 #include <vector>
 
+#if defined(__GNUC__)
 union sse_float4 {
     float __attribute__ ((vector_size (16))) vector;
     float elements[4];
 };
+#endif
 
 void sse_test(Mesh &);
\ No newline at end of file
@@ -1,180 +1,1734 @@
 #include "OBJLoader.hpp"
+#include "compressedFile.hpp"
+#include "mappedFile.hpp"
+#include "meshCache.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <memory>
+#include <stdexcept>
 
-float3 computeTriangleNormal(std::vector<float4> &vertices, unsigned int baseIndex);
+// The loader works directly on the mapped file. Lines are scanned in place:
+// a token is a [begin, end) range of characters in the file, so no strings
+// are created, and numbers are converted by the parsers below, which do not
+// depend on the locale.
 
-void split(std::vector<std::string>* parts, const std::string &s, char delim) {
+// Size of the text inflated at a time when a compressed file is streamed
+static const size_t inflateWindowSize = 1 << 20;
 
-	std::stringstream ss;
-	ss.str(s);
-	std::string item;
-	while (std::getline(ss, item, delim)) {
-		parts->push_back(item);
+/**
+ * @return whether the character separates tokens on a line
+ */
+static inline bool isSeparator(char const c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * @return whether the character is a decimal digit
+ */
+static inline bool isDigit(char const c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Powers of ten which are exactly representable in float and double
+static const float floatPowersOfTen[] = {
+	1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+static const double doublePowersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Converts a token with strtof, for the numbers the fast paths of parseFloat
+ * do not handle
+ * @param  begin first character of the token
+ * @param  end   end of the token
+ * @param  value returned number
+ * @return       false if the token is not a number
+ */
+static bool parseFloatSlow(char const *begin, char const *end, float &value)
+{
+	// strtof needs a terminated string
+	size_t length = size_t(end - begin);
+	char buffer[64];
+	std::string longToken;
+	char *text = buffer;
+	if (length >= sizeof(buffer)) {
+		longToken.assign(begin, end);
+		text = &longToken[0];
+	} else {
+		std::memcpy(buffer, begin, length);
+		buffer[length] = '\0';
 	}
+
+	char *parsedEnd;
+	value = std::strtof(text, &parsedEnd);
+	return length != 0 && parsedEnd == text + length;
 }
 
-void deleteEmptyStrings(std::vector<std::string> &list) {
-	for (unsigned int i = 0; i < list.size(); i++) {
-		std::string item = list.at(i);
-		if (item == "" || item == "\r") {
-			list.erase(list.begin() + i);
-			i--;
+/**
+ * Parses a decimal floating point number. The result is correctly rounded,
+ * exactly like strtof (and therefore std::stof).
+ *
+ * The digits are first collected in a 64-bit integer m with a decimal
+ * exponent e. When both m and 10^|e| are exactly representable, a single
+ * multiplication or division gives the correctly rounded result (Clinger's
+ * fast path). In float this covers m <= 2^24 and |e| <= 10. Beyond that the
+ * number is computed in double for m <= 2^53 and |e| <= 22. Rounding that
+ * result to float gives the correctly rounded float, unless the double lies
+ * exactly halfway between two floats. Those rare values, very long mantissas,
+ * and special forms such as "inf" go through strtof.
+ * @param  begin first character of the token
+ * @param  end   end of the token
+ * @param  value returned number
+ * @return       false if the token is not a number
+ */
+static bool parseFloat(char const *begin, char const *end, float &value)
+{
+	char const *c = begin;
+	bool negative = false;
+	if (c != end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	unsigned int significantDigits = 0;
+	bool anyDigits = false;
+	bool truncated = false;
+
+	for (; c != end && isDigit(*c); c++) {
+		anyDigits = true;
+		if (significantDigits < 19) {
+			mantissa = mantissa * 10 + uint64_t(*c - '0');
+			significantDigits += mantissa != 0;
+		} else {
+			truncated = true;
+			exponent++;
+		}
+	}
+	if (c != end && *c == '.') {
+		for (c++; c != end && isDigit(*c); c++) {
+			anyDigits = true;
+			if (significantDigits < 19) {
+				mantissa = mantissa * 10 + uint64_t(*c - '0');
+				significantDigits += mantissa != 0;
+				exponent--;
+			} else {
+				truncated = true;
+			}
 		}
 	}
+	if (anyDigits && c != end && (*c == 'e' || *c == 'E')) {
+		char const *exponentStart = ++c;
+		bool negativeExponent = false;
+		if (c != end && (*c == '-' || *c == '+')) {
+			negativeExponent = *c == '-';
+			c++;
+		}
+		int explicitExponent = 0;
+		for (; c != end && isDigit(*c); c++) {
+			// Anything this large over- or underflows anyway
+			explicitExponent = std::min(explicitExponent * 10 + (*c - '0'), 100000);
+		}
+		if (c == exponentStart || !isDigit(*(c - 1))) {
+			return parseFloatSlow(begin, end, value);
+		}
+		exponent += negativeExponent ? -explicitExponent : explicitExponent;
+	}
+
+	if (!anyDigits || c != end || truncated) {
+		return parseFloatSlow(begin, end, value);
+	}
+
+	if (mantissa == 0) {
+		value = negative ? -0.0f : 0.0f;
+		return true;
+	}
+
+	if (mantissa <= (uint64_t(1) << 24) && exponent >= -10 && exponent <= 10) {
+		float result = float(mantissa);
+		result = exponent < 0 ? result / floatPowersOfTen[-exponent] : result * floatPowersOfTen[exponent];
+		value = negative ? -result : result;
+		return true;
+	}
+
+	if (mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+		double result = double(mantissa);
+		result = exponent < 0 ? result / doublePowersOfTen[-exponent] : result * doublePowersOfTen[exponent];
+		if (result >= double(FLT_MIN) && result <= double(FLT_MAX)) {
+			// A double has 29 more mantissa bits than a float. A float midpoint
+			// has only the highest of those set.
+			uint64_t bits;
+			std::memcpy(&bits, &result, sizeof(bits));
+			uint64_t const lowBits = bits & ((uint64_t(1) << 29) - 1);
+			if (lowBits != (uint64_t(1) << 28)) {
+				float rounded = float(result);
+				value = negative ? -rounded : rounded;
+				return true;
+			}
+		}
+	}
+
+	return parseFloatSlow(begin, end, value);
+}
+
+/**
+ * Parses a decimal integer with an optional sign
+ * @param  begin first character of the token
+ * @param  end   end of the token
+ * @param  value returned number
+ * @return       false if the token is not an integer, or too large
+ */
+static bool parseInteger(char const *begin, char const *end, long &value)
+{
+	char const *c = begin;
+	bool negative = false;
+	if (c != end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+	if (c == end) {
+		return false;
+	}
+	long result = 0;
+	for (; c != end; c++) {
+		if (!isDigit(*c) || result > 100000000000L) {
+			return false;
+		}
+		result = result * 10 + (*c - '0');
+	}
+	value = negative ? -result : result;
+	return true;
 }
 
-Mesh loadOBJ(std::string src)
+// --- Chunked parsing ---
+
+// Large files are split into chunks of whole lines, which are parsed by all
+// worker threads at once. Faces can refer to vertices declared in any earlier
+// chunk, so a chunk is parsed in two passes:
+//
+// 1. Declarations: the "v" and "vn" lines of every chunk are parsed into
+//    arrays of that chunk, and its lines are counted.
+// 2. Faces: once the arrays of all chunks are concatenated, the number of
+//    vertices and normals declared before each chunk is known, and the faces
+//    can be resolved exactly as if the file was read from the start.
+//
+// The triangles of each chunk are finally concatenated in file order, so the
+// mesh does not depend on the number of threads.
+
+enum class OBJKeyword {
+	Vertex,
+	Normal,
+	Face,
+	Other
+};
+
+/**
+ * Finds the keyword at the start of a line
+ * @param  c   first character of the line, returns the first character after the keyword
+ * @param  end end of the line
+ * @return     the keyword
+ */
+static OBJKeyword readKeyword(char const *&c, char const *end)
 {
-	std::vector<std::string> lineParts;
-	lineParts.reserve(32);
-	std::vector<std::string> faceParts;
-	faceParts.reserve(32);
+	while (c != end && isSeparator(*c)) {
+		c++;
+	}
+	char const *keyword = c;
+	while (c != end && !isSeparator(*c)) {
+		c++;
+	}
+	size_t length = size_t(c - keyword);
 
-	std::vector<float4> vertices;
-	std::vector<float3> normals;
+	if (length == 1 && keyword[0] == 'v') {
+		return OBJKeyword::Vertex;
+	} else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+		return OBJKeyword::Normal;
+	} else if (length == 1 && keyword[0] == 'f') {
+		return OBJKeyword::Face;
+	}
+	// Comments, texture coordinates, groups and materials are ignored
+	return OBJKeyword::Other;
+}
 
+/**
+ * Calls function(lineBegin, lineEnd) for every line in a range, until it returns false
+ * @param begin    first character of the first line
+ * @param end      end of the last line
+ * @param function callable with signature bool(char const *, char const *)
+ */
+template <typename Function>
+static void forEachLine(char const *begin, char const *end, Function function)
+{
+	char const *lineBegin = begin;
+	while (lineBegin != end) {
+		char const *lineEnd = static_cast<char const *>(std::memchr(lineBegin, '\n', size_t(end - lineBegin)));
+		char const *next = lineEnd == nullptr ? end : lineEnd + 1;
+		if (lineEnd == nullptr) {
+			lineEnd = end;
+		}
+		if (!function(lineBegin, lineEnd)) {
+			return;
+		}
+		lineBegin = next;
+	}
+}
+
+/**
+ * Parses the 3 coordinates of a "v" or "vn" line. Further coordinates, such
+ * as the optional w of a vertex, are ignored.
+ * @param c     first character after the keyword
+ * @param end   end of the line
+ * @param value returned coordinates
+ */
+static void parseCoordinates(char const *c, char const *end, float3 &value)
+{
+	float *coordinates[3] = {&value.x, &value.y, &value.z};
+	for (unsigned int i = 0; i < 3; i++) {
+		while (c != end && isSeparator(*c)) {
+			c++;
+		}
+		char const *tokenBegin = c;
+		while (c != end && !isSeparator(*c)) {
+			c++;
+		}
+		if (tokenBegin == c) {
+			throw std::runtime_error("Expected 3 coordinates");
+		}
+		if (!parseFloat(tokenBegin, c, *coordinates[i])) {
+			throw std::runtime_error("Invalid number '" + std::string(tokenBegin, c) + "'");
+		}
+	}
+}
+
+/**
+ * Corner of a triangle: the 0-based indices of its position and normal
+ */
+typedef struct OBJCorner {
+	static const uint32_t noNormal = 0xFFFFFFFFu;
+
+	uint32_t vertex;
+	uint32_t normal;
+} OBJCorner;
+
+/**
+ * A chunk of whole lines of the file, and everything parsed from it
+ */
+typedef struct OBJChunk {
+	char const *begin;
+	char const *end;
+
+	// Declarations pass: positions and normals declared by "v" and "vn" lines
 	std::vector<float4> vertexBuffer;
 	std::vector<float3> normalBuffer;
+	size_t lineCount;
+
+	// Faces pass: the corners of all triangles, and how many of them have a normal
+	std::vector<OBJCorner> corners;
+	size_t cornersWithNormal;
+
+	// First error in the chunk. The line number counts from the start of the chunk.
+	bool failed;
+	size_t errorLine;
+	std::string errorMessage;
+	// Start of the line with the error, later lines are not parsed
+	char const *errorLineBegin;
+
+	OBJChunk() {
+		begin = nullptr;
+		end = nullptr;
+		lineCount = 0;
+		cornersWithNormal = 0;
+		failed = false;
+		errorLine = 0;
+		errorLineBegin = nullptr;
+	}
+
+	void fail(size_t line, char const *lineBegin, std::string const &message) {
+		if (!failed || line < errorLine) {
+			failed = true;
+			errorLine = line;
+			errorLineBegin = lineBegin;
+			errorMessage = message;
+		}
+	}
+} OBJChunk;
+
+/**
+ * Declarations pass over a chunk
+ * @param chunk chunk to parse
+ */
+static void parseDeclarations(OBJChunk &chunk)
+{
+	forEachLine(chunk.begin, chunk.end, [&](char const *lineBegin, char const *lineEnd) {
+		chunk.lineCount++;
+		char const *c = lineBegin;
+		try {
+			OBJKeyword keyword = readKeyword(c, lineEnd);
+			if (keyword == OBJKeyword::Vertex) {
+				float3 position;
+				parseCoordinates(c, lineEnd, position);
+				float4 vertex;
+				vertex.x = position.x;
+				vertex.y = position.y;
+				vertex.z = position.z;
+				vertex.w = 1;
+				chunk.vertexBuffer.push_back(vertex);
+			} else if (keyword == OBJKeyword::Normal) {
+				float3 normal;
+				parseCoordinates(c, lineEnd, normal);
+				chunk.normalBuffer.push_back(normal);
+			}
+		} catch (std::runtime_error const &error) {
+			chunk.fail(chunk.lineCount, lineBegin, error.what());
+			return false;
+		}
+		return true;
+	});
+}
+
+/**
+ * Resolves the face corners of a chunk to indices into the positions and
+ * normals of the whole file, and splits the faces into triangles
+ */
+typedef struct OBJFaceParser {
+	OBJChunk &chunk;
+
+	// Number of positions and normals declared before the current line
+	size_t vertexCount;
+	size_t normalCount;
+
+	// Positions of the whole file, to triangulate polygons with more than 4 corners
+	float4 const *positions;
+
+	// Scratch space for the current face, reused for every face
+	std::vector<OBJCorner> polygon;
+	std::vector<float2> projected;
+	std::vector<uint32_t> remaining;
+
+	OBJFaceParser(OBJChunk &chunk, size_t vertexCount, size_t normalCount, float4 const *positions) : chunk(chunk) {
+		this->vertexCount = vertexCount;
+		this->normalCount = normalCount;
+		this->positions = positions;
+	}
+
+	/**
+	 * Converts an OBJ index (1-based, or negative relative to the end) to a
+	 * 0-based index
+	 * @param  index index in the file
+	 * @param  count number of elements declared so far
+	 * @return       0-based index, negative if it lies before the first element
+	 */
+	static long resolveIndex(long const index, size_t const count) {
+		if (index == 0) {
+			throw std::runtime_error("Invalid index 0");
+		}
+		return index > 0 ? index - 1 : long(count) + index;
+	}
+
+	/**
+	 * Parses a corner of a face, given as "v", "v/vt", "v//vn" or "v/vt/vn"
+	 * @param  begin first character of the corner
+	 * @param  end   end of the corner
+	 * @return       the corner
+	 */
+	OBJCorner parseCorner(char const *begin, char const *end) const {
+		char const *parts[3][2];
+		unsigned int partCount = 0;
+		char const *partBegin = begin;
+		for (char const *c = begin; ; c++) {
+			if (c == end || *c == '/') {
+				if (partCount == 3) {
+					throw std::runtime_error("Invalid face corner '" + std::string(begin, end) + "'");
+				}
+				parts[partCount][0] = partBegin;
+				parts[partCount][1] = c;
+				partCount++;
+				partBegin = c + 1;
+				if (c == end) {
+					break;
+				}
+			}
+		}
 
-	std::vector<unsigned int> indices;
+		long vertexIndex;
+		if (!parseInteger(parts[0][0], parts[0][1], vertexIndex)) {
+			throw std::runtime_error("Invalid face corner '" + std::string(begin, end) + "'");
+		}
+		vertexIndex = resolveIndex(vertexIndex, vertexCount);
+		if (vertexIndex < 0 || size_t(vertexIndex) >= vertexCount) {
+			throw std::runtime_error("Vertex index out of range");
+		}
+		OBJCorner corner;
+		corner.vertex = uint32_t(vertexIndex);
+		corner.normal = OBJCorner::noNormal;
 
-	std::ifstream objFile(src);
-	std::string line;
+		// The texture coordinate (the second part) is not used by the renderer
+		if (partCount == 3 && parts[2][0] != parts[2][1]) {
+			long normalIndex;
+			if (!parseInteger(parts[2][0], parts[2][1], normalIndex)) {
+				throw std::runtime_error("Invalid face corner '" + std::string(begin, end) + "'");
+			}
+			normalIndex = resolveIndex(normalIndex, normalCount);
 
-	unsigned int currentIndex = 0;
+			// (partially) invalid files may contain normals later, or in some cases not at all.
+			// Those corners do not get a normal.
+			if (normalIndex >= 0 && size_t(normalIndex) < normalCount) {
+				corner.normal = uint32_t(normalIndex);
+			}
+		}
+		return corner;
+	}
 
-	if (objFile.is_open()) {
-		// int lineNumber = -1;
-		while (std::getline(objFile, line)) {
-			lineParts.clear();
-			split(&lineParts, line, ' ');
-			deleteEmptyStrings(lineParts);
+	/**
+	 * Adds a triangle of the current face
+	 * @param a index of the first corner in the polygon
+	 * @param b index of the second corner
+	 * @param c index of the third corner
+	 */
+	void addTriangle(uint32_t const a, uint32_t const b, uint32_t const c) {
+		uint32_t const triangle[3] = {a, b, c};
+		for (unsigned int i = 0; i < 3; i++) {
+			OBJCorner const &corner = polygon[triangle[i]];
+			if (corner.normal != OBJCorner::noNormal) {
+				chunk.cornersWithNormal++;
+			}
+			chunk.corners.push_back(corner);
+		}
+	}
 
-			if (lineParts.size() == 0) {
+	/**
+	 * Projects the current face on the plane it is (most) parallel to, such
+	 * that its corners run counter-clockwise
+	 */
+	void projectPolygon() {
+		// Newell's method gives the normal of a polygon, also a non-planar or concave one
+		float3 normal = make_float3(0, 0, 0);
+		for (size_t i = 0; i < polygon.size(); i++) {
+			float4 const &current = positions[polygon[i].vertex];
+			float4 const &next = positions[polygon[(i + 1) % polygon.size()].vertex];
+			normal.x += (current.y - next.y) * (current.z + next.z);
+			normal.y += (current.z - next.z) * (current.x + next.x);
+			normal.z += (current.x - next.x) * (current.y + next.y);
+		}
+
+		// Dropping the largest axis of the normal keeps the polygon as large as possible.
+		// Looking against the normal, the corners run counter-clockwise.
+		float ax = std::fabs(normal.x);
+		float ay = std::fabs(normal.y);
+		float az = std::fabs(normal.z);
+		projected.resize(polygon.size());
+		for (size_t i = 0; i < polygon.size(); i++) {
+			float4 const &position = positions[polygon[i].vertex];
+			float2 &point = projected[i];
+			if (az >= ax && az >= ay) {
+				point.x = position.x;
+				point.y = normal.z >= 0 ? position.y : -position.y;
+			} else if (ax >= ay) {
+				point.x = position.y;
+				point.y = normal.x >= 0 ? position.z : -position.z;
+			} else {
+				point.x = position.z;
+				point.y = normal.y >= 0 ? position.x : -position.x;
+			}
+		}
+	}
+
+	/**
+	 * @return twice the signed area of a triangle of projected corners,
+	 *         positive if it runs counter-clockwise
+	 */
+	float orientation(uint32_t const a, uint32_t const b, uint32_t const c) const {
+		float2 const &pa = projected[a];
+		float2 const &pb = projected[b];
+		float2 const &pc = projected[c];
+		return (pb.x - pa.x) * (pc.y - pa.y) - (pb.y - pa.y) * (pc.x - pa.x);
+	}
+
+	/**
+	 * Tests whether the corner at a position of the remaining polygon is an
+	 * ear: a convex corner whose triangle with its neighbours contains no
+	 * other remaining corner
+	 * @param  i position in the remaining polygon
+	 * @return   whether the corner can be clipped
+	 */
+	bool isEar(size_t const i) const {
+		size_t count = remaining.size();
+		uint32_t a = remaining[(i + count - 1) % count];
+		uint32_t b = remaining[i];
+		uint32_t c = remaining[(i + 1) % count];
+		if (!(orientation(a, b, c) > 0)) {
+			return false;
+		}
+		for (size_t j = 0; j < count; j++) {
+			uint32_t p = remaining[j];
+			if (p == a || p == b || p == c) {
 				continue;
 			}
+			if (orientation(a, b, p) >= 0 && orientation(b, c, p) >= 0 && orientation(c, a, p) >= 0) {
+				return false;
+			}
+		}
+		return true;
+	}
 
-			if (lineParts.at(0) == "v") {
-				float4 vertex;
-				vertex.x = std::stof(lineParts.at(1));
-				vertex.y = std::stof(lineParts.at(2));
-				vertex.z = std::stof(lineParts.at(3));
-				vertex.w = 1;
-				vertexBuffer.push_back(vertex);
+	/**
+	 * Splits the current face into triangles by ear clipping, which also
+	 * handles concave polygons
+	 */
+	void clipEars() {
+		projectPolygon();
+		remaining.resize(polygon.size());
+		for (size_t i = 0; i < polygon.size(); i++) {
+			remaining[i] = uint32_t(i);
+		}
+
+		size_t i = 0;
+		size_t cornersTested = 0;
+		while (remaining.size() > 3) {
+			if (isEar(i)) {
+				size_t count = remaining.size();
+				addTriangle(remaining[(i + count - 1) % count], remaining[i], remaining[(i + 1) % count]);
+				remaining.erase(remaining.begin() + long(i));
+				// The previous corner may have become an ear
+				i = (i + remaining.size() - 1) % remaining.size();
+				cornersTested = 0;
+			} else {
+				i = (i + 1) % remaining.size();
+				// No ear left in a degenerate or self-intersecting polygon
+				if (++cornersTested == remaining.size()) {
+					break;
+				}
 			}
+		}
 
-			if (lineParts.at(0) == "vn") {
-				float3 normal;
-				normal.x = std::stof(lineParts.at(1));
-				normal.y = std::stof(lineParts.at(2));
-				normal.z = std::stof(lineParts.at(3));
-				normalBuffer.push_back(normal);
+		// The last triangle, or a fan over what remains of a degenerate polygon
+		for (size_t j = 1; j + 1 < remaining.size(); j++) {
+			addTriangle(remaining[0], remaining[j], remaining[j + 1]);
+		}
+	}
+
+	/**
+	 * Parses the corners of an "f" line and splits the face into triangles
+	 * @param c   first character after the keyword
+	 * @param end end of the line
+	 */
+	void parseFace(char const *c, char const *end) {
+		polygon.clear();
+		while (true) {
+			while (c != end && isSeparator(*c)) {
+				c++;
+			}
+			if (c == end) {
+				break;
+			}
+			char const *tokenBegin = c;
+			while (c != end && !isSeparator(*c)) {
+				c++;
 			}
+			polygon.push_back(parseCorner(tokenBegin, c));
+		}
+		if (polygon.size() < 3) {
+			throw std::runtime_error("A face needs at least 3 corners");
+		}
 
-			if (lineParts.at(0) == "f") {
-				for (int i = 1; i <= 3; i++) {
-					faceParts.clear();
-					std::string linePart = lineParts.at(i);
-					split(&faceParts, linePart, '/');
+		// Triangles are kept, and quads are split into the triangles (1, 2, 3) and (1, 3, 4)
+		if (polygon.size() <= 4) {
+			addTriangle(0, 1, 2);
+			if (polygon.size() == 4) {
+				addTriangle(0, 2, 3);
+			}
+		} else {
+			clipEars();
+		}
+	}
 
-					int vertexIndex = std::stoi(faceParts.at(0)) - 1;
-					float4 vertex = vertexBuffer.at(unsigned(vertexIndex));
-					vertices.push_back(vertex);
+	/**
+	 * Faces pass over the chunk, up to a given line
+	 * @param end end of the last line to parse
+	 */
+	void parseFaces(char const *end) {
+		size_t lineNumber = 0;
+		forEachLine(chunk.begin, end, [&](char const *lineBegin, char const *lineEnd) {
+			lineNumber++;
+			char const *c = lineBegin;
+			OBJKeyword keyword = readKeyword(c, lineEnd);
+			if (keyword == OBJKeyword::Vertex) {
+				vertexCount++;
+			} else if (keyword == OBJKeyword::Normal) {
+				normalCount++;
+			} else if (keyword == OBJKeyword::Face) {
+				try {
+					parseFace(c, lineEnd);
+				} catch (std::runtime_error const &error) {
+					chunk.fail(lineNumber, lineBegin, error.what());
+					return false;
+				}
+			}
+			return true;
+		});
+	}
+} OBJFaceParser;
 
-					int normalIndex = -1;
+/**
+ * Splits a file in chunks of whole lines
+ * @param  begin      start of the file
+ * @param  end        end of the file
+ * @param  chunkCount maximum number of chunks
+ * @return            chunks in file order
+ */
+static std::vector<OBJChunk> splitChunks(char const *begin, char const *end, size_t chunkCount)
+{
+	// Small files are not worth starting threads for
+	size_t const minimumChunkSize = 1 << 20;
+	size_t size = size_t(end - begin);
+	chunkCount = std::max(size_t(1), std::min(chunkCount, size / minimumChunkSize));
 
-					if(faceParts.size() == 2) {
-						normalIndex = std::stoi(faceParts.at(1)) - 1;
-					}
-					else if (faceParts.size() == 3 && faceParts.at(1) == "") {
-						normalIndex = std::stoi(faceParts.at(2)) - 1;
-					}
-					else if (faceParts.size() == 3) {
-						normalIndex = std::stoi(faceParts.at(2)) - 1;
-					}
+	std::vector<OBJChunk> chunks(chunkCount);
+	char const *chunkBegin = begin;
+	for (size_t i = 0; i < chunkCount; i++) {
+		char const *chunkEnd = end;
+		if (i + 1 < chunkCount) {
+			chunkEnd = std::max(chunkBegin, begin + (size * (i + 1)) / chunkCount);
+			char const *newline = static_cast<char const *>(std::memchr(chunkEnd, '\n', size_t(end - chunkEnd)));
+			chunkEnd = newline == nullptr ? end : newline + 1;
+		}
+		chunks[i].begin = chunkBegin;
+		chunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+	return chunks;
+}
 
-					// (partially) invalid files may contain normals later, or in some cases not at all.
-					// This check accounts for that. If it fails, normals are computed after processing
-					// the contents of the current line in the file
-					if(normalIndex != -1 && normalBuffer.size() > (unsigned int) normalIndex) {
-						normals.push_back(normalBuffer.at(normalIndex));
-					}
+/**
+ * Concatenates the arrays of the chunks in order
+ * @param chunks chunks
+ * @param member array of a chunk to concatenate
+ * @param output returned concatenation
+ */
+template <typename T>
+static void concatenate(std::vector<OBJChunk> const &chunks, std::vector<T> OBJChunk::*member, T *output)
+{
+	std::vector<size_t> offsets(chunks.size() + 1, 0);
+	for (size_t i = 0; i < chunks.size(); i++) {
+		offsets[i + 1] = offsets[i] + (chunks[i].*member).size();
+	}
+	parallelFor(chunks.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			std::copy((chunks[i].*member).begin(), (chunks[i].*member).end(), output + offsets[i]);
+		}
+	});
+}
+
+MeshLayout Mesh::layout() const
+{
+	MeshLayout layout;
+	layout.vertexCount = vertexCount;
+	layout.normalCount = quantisedVertices != nullptr ? 0 : normalCount;
+	layout.indexCount = indexCount;
+	layout.lodIndexCount = lodIndexCount;
+	layout.quantised = quantisedVertices != nullptr;
+	layout.shortIndices = shortIndices != nullptr;
+	layout.vertexStreams = streams.x != nullptr;
+	return layout;
+}
+
+void Mesh::allocate(MeshLayout const &layout)
+{
+	// Every array starts on a cache line of its own
+	size_t const alignment = 64;
+	auto alignUp = [&](size_t offset) {
+		return (offset + alignment - 1) / alignment * alignment;
+	};
+	size_t indexSize = layout.shortIndices ? sizeof(uint16_t) : sizeof(unsigned int);
+	size_t vertexOffset = 0;
+	size_t normalOffset = alignUp(vertexOffset + (layout.quantised ? sizeof(QuantisedVertex) : sizeof(float4)) * layout.vertexCount);
+	bool vertexStreams = layout.vertexStreams && !layout.quantised;
+	size_t streamOffset = alignUp(normalOffset + sizeof(float3) * layout.normalCount);
+	size_t streamSize = vertexStreams ? 6 * VertexStreams::stride(layout.vertexCount) * sizeof(float) : 0;
+	size_t indexOffset = alignUp(streamOffset + streamSize);
+	size_t lodIndexOffset = alignUp(indexOffset + indexSize * layout.indexCount);
+	size_t size = lodIndexOffset + indexSize * layout.lodIndexCount;
+
+	storage.reset();
+	arena.reset(new char[size + alignment - 1]);
+	char *base = arena.get() + (alignment - reinterpret_cast<uintptr_t>(arena.get()) % alignment) % alignment;
+
+	vertices = nullptr;
+	normals = nullptr;
+	streams = VertexStreams();
+	quantisedVertices = nullptr;
+	indices = nullptr;
+	shortIndices = nullptr;
+	lodIndices = nullptr;
+	shortLodIndices = nullptr;
+	if (layout.quantised) {
+		quantisedVertices = reinterpret_cast<QuantisedVertex *>(base + vertexOffset);
+	} else {
+		vertices = reinterpret_cast<float4 *>(base + vertexOffset);
+		normals = reinterpret_cast<float3 *>(base + normalOffset);
+	}
+	if (vertexStreams) {
+		streams.assign(reinterpret_cast<float *>(base + streamOffset), layout.vertexCount);
+	}
+	if (layout.shortIndices) {
+		shortIndices = reinterpret_cast<uint16_t *>(base + indexOffset);
+		shortLodIndices = layout.lodIndexCount > 0 ? reinterpret_cast<uint16_t *>(base + lodIndexOffset) : nullptr;
+	} else {
+		indices = reinterpret_cast<unsigned int *>(base + indexOffset);
+		lodIndices = layout.lodIndexCount > 0 ? reinterpret_cast<unsigned int *>(base + lodIndexOffset) : nullptr;
+	}
+	vertexCount = layout.vertexCount;
+	// A quantised vertex holds the normal of the vertex
+	normalCount = layout.quantised ? layout.vertexCount : layout.normalCount;
+	indexCount = layout.indexCount;
+	lodIndexCount = layout.lodIndexCount;
+}
+
+/**
+ * Sizes and formats of the arrays of a loaded mesh: quantised vertices, or
+ * float vertices and normals with vertex streams if the options ask for them,
+ * and 16-bit indices when the vertices fit, which halves the memory the
+ * triangles fetch their vertices through. A mesh for the optimiser or the
+ * simplifier keeps float vertices and 32-bit indices until it is stored (see
+ * storeLoadedMesh). Every vertex has a normal.
+ * @param  vertexCount    number of vertices
+ * @param  indexCount     number of indices
+ * @param  lodIndexCount  number of indices of the levels of detail
+ * @param  options        load options
+ * @param  postProcessing whether the mesh goes through the optimiser or the simplifier first
+ * @return                layout of the mesh
+ */
+static MeshLayout loadedLayout( size_t vertexCount,
+								size_t indexCount,
+								size_t lodIndexCount,
+								LoadOptions const &options,
+								bool postProcessing )
+{
+	MeshLayout layout;
+	layout.vertexCount = vertexCount;
+	layout.indexCount = indexCount;
+	layout.lodIndexCount = lodIndexCount;
+	if (!postProcessing) {
+		layout.quantised = options.quantised && vertexCount > 0;
+		layout.shortIndices = vertexCount <= 65536;
+		layout.vertexStreams = options.vertexStreams && !layout.quantised;
+	}
+	layout.normalCount = layout.quantised ? 0 : vertexCount;
+	return layout;
+}
+
+/**
+ * Stores a vertex of a mesh, in the format it was allocated with. A quantised
+ * mesh needs its quantisation parameters first.
+ * @param mesh     Mesh object
+ * @param i        index of the vertex
+ * @param position position of the vertex
+ * @param normal   normal of the vertex
+ */
+static inline void storeVertex(Mesh &mesh, size_t i, float4 const &position, float3 const &normal)
+{
+	if (mesh.quantisedVertices != nullptr) {
+		mesh.quantisedVertices[i] = quantiseVertex(position, normal, mesh.quantisationOffset, mesh.quantisationScale);
+		return;
+	}
+	mesh.vertices[i] = position;
+	mesh.normals[i] = normal;
+	if (mesh.streams.x != nullptr) {
+		mesh.streams.write(i, position, normal);
+	}
+}
+
+/**
+ * Stores an entry of the index buffer of a mesh, in the width it was allocated with
+ * @param mesh  Mesh object
+ * @param i     position in the index buffer
+ * @param index index of the vertex
+ */
+static inline void storeIndex(Mesh &mesh, size_t i, unsigned int index)
+{
+	if (mesh.shortIndices != nullptr) {
+		mesh.shortIndices[i] = uint16_t(index);
+	} else {
+		mesh.indices[i] = index;
+	}
+}
+
+/**
+ * Sets the quantisation parameters of a quantised mesh from the bounding box
+ * of its vertices
+ * @param mesh  Mesh object with quantised vertices
+ * @param lower lower corner of the bounding box
+ * @param upper upper corner of the bounding box
+ */
+static void setQuantisation(Mesh &mesh, float3 const &lower, float3 const &upper)
+{
+	mesh.quantisationOffset = lower;
+	mesh.quantisationScale = quantisationScale(lower, upper);
+}
+
+/**
+ * Grows a bounding box to contain the positions of corners
+ * @param corners      corners
+ * @param vertexBuffer positions of the whole file
+ * @param lower        lower corner of the bounding box
+ * @param upper        upper corner of the bounding box
+ */
+static void extendBounds( std::vector<OBJCorner> const &corners,
+						  std::vector<float4> const &vertexBuffer,
+						  float3 &lower,
+						  float3 &upper )
+{
+	for (OBJCorner const &corner : corners) {
+		float4 const &position = vertexBuffer[corner.vertex];
+		lower = make_float3(std::min(lower.x, position.x), std::min(lower.y, position.y), std::min(lower.z, position.z));
+		upper = make_float3(std::max(upper.x, position.x), std::max(upper.y, position.y), std::max(upper.z, position.z));
+	}
+}
+
+/**
+ * @return normal of a corner; zero for a corner without one, which there are none of after generateNormals
+ */
+static inline float3 cornerNormal(OBJCorner const &corner, std::vector<float3> const &normalBuffer)
+{
+	return corner.normal == OBJCorner::noNormal ? make_float3(0, 0, 0) : normalBuffer[corner.normal];
+}
+
+/**
+ * Builds the mesh the way the renderer originally received it: every corner of
+ * every triangle is a vertex of its own, and the index buffer counts up.
+ * @param chunks         parsed chunks in file order
+ * @param vertexBuffer   positions of the whole file
+ * @param normalBuffer   normals of the whole file
+ * @param options        load options, for the layout of the mesh (see loadedLayout)
+ * @param postProcessing whether the mesh goes through the optimiser or the simplifier
+ * @param release        free the corners, positions and normals as soon as they
+ *                       are stored; streamOBJ keeps the positions and normals
+ *                       for the following batches
+ * @param mesh           returned mesh
+ */
+static void buildDeindexedMesh( std::vector<OBJChunk> &chunks,
+								std::vector<float4> &vertexBuffer,
+								std::vector<float3> &normalBuffer,
+								LoadOptions const &options,
+								bool postProcessing,
+								bool release,
+								Mesh &mesh )
+{
+	std::vector<size_t> cornerOffsets(chunks.size() + 1, 0);
+	for (size_t i = 0; i < chunks.size(); i++) {
+		cornerOffsets[i + 1] = cornerOffsets[i] + chunks[i].corners.size();
+	}
+	size_t vertexCount = cornerOffsets[chunks.size()];
+
+	mesh.allocate(loadedLayout(vertexCount, vertexCount, 0, options, postProcessing));
+	if (mesh.quantisedVertices != nullptr) {
+		// The box starts at vertex 0, as in computeBounds
+		size_t first = 0;
+		while (chunks[first].corners.empty()) {
+			first++;
+		}
+		float3 lower = vertexBuffer[chunks[first].corners[0].vertex].toFloat3();
+		float3 upper = lower;
+		for (OBJChunk const &chunk : chunks) {
+			extendBounds(chunk.corners, vertexBuffer, lower, upper);
+		}
+		setQuantisation(mesh, lower, upper);
+	}
+	parallelFor(chunks.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			size_t index = cornerOffsets[i];
+			for (OBJCorner const &corner : chunks[i].corners) {
+				storeVertex(mesh, index, vertexBuffer[corner.vertex], cornerNormal(corner, normalBuffer));
+				storeIndex(mesh, index, (unsigned int) index);
+				index++;
+			}
+			if (release) {
+				std::vector<OBJCorner>().swap(chunks[i].corners);
+			}
+		}
+	});
+	if (release) {
+		std::vector<float4>().swap(vertexBuffer);
+		std::vector<float3>().swap(normalBuffer);
+	}
+}
+
+/**
+ * Hash map from corners to vertex indices. Open addressing with linear
+ * probing over a power of two table keeps every lookup within a few adjacent
+ * slots, and needs no allocation per entry.
+ */
+typedef struct CornerMap {
+	static const uint64_t emptyKey = ~uint64_t(0);
+
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> values;
+	size_t count;
+
+	explicit CornerMap(size_t expectedCount) {
+		size_t capacity = 16;
+		while (capacity < 2 * expectedCount) {
+			capacity *= 2;
+		}
+		keys.assign(capacity, emptyKey);
+		values.resize(capacity);
+		count = 0;
+	}
+
+	static uint64_t key(OBJCorner const corner) {
+		return (uint64_t(corner.vertex) << 32) | uint64_t(corner.normal);
+	}
+
+	static size_t hash(uint64_t const key) {
+		// Fibonacci hashing spreads consecutive indices over the whole table. The
+		// upper half of the product depends on both halves of the key, also when
+		// the normal half is constant.
+		return size_t((key * 0x9E3779B97F4A7C15ull) >> 32);
+	}
 
-					indices.push_back(currentIndex);
-					currentIndex++;
+	/**
+	 * Finds the vertex of a corner, or adds it
+	 * @param  corner   corner to look up
+	 * @param  newValue vertex index to store if the corner is new
+	 * @return          vertex index of the corner
+	 */
+	uint32_t findOrInsert(OBJCorner const corner, uint32_t const newValue) {
+		if (2 * (count + 1) > keys.size()) {
+			grow();
+		}
+		uint64_t k = key(corner);
+		size_t mask = keys.size() - 1;
+		for (size_t slot = hash(k) & mask; ; slot = (slot + 1) & mask) {
+			if (keys[slot] == k) {
+				return values[slot];
+			}
+			if (keys[slot] == emptyKey) {
+				keys[slot] = k;
+				values[slot] = newValue;
+				count++;
+				return newValue;
+			}
+		}
+	}
+
+	void grow() {
+		std::vector<uint64_t> oldKeys(2 * keys.size(), emptyKey);
+		std::vector<uint32_t> oldValues(2 * keys.size());
+		oldKeys.swap(keys);
+		oldValues.swap(values);
+		size_t mask = keys.size() - 1;
+		for (size_t i = 0; i < oldKeys.size(); i++) {
+			if (oldKeys[i] != emptyKey) {
+				size_t slot = hash(oldKeys[i]) & mask;
+				while (keys[slot] != emptyKey) {
+					slot = (slot + 1) & mask;
+				}
+				keys[slot] = oldKeys[i];
+				values[slot] = oldValues[i];
+			}
+		}
+	}
+} CornerMap;
+
+// Bound to references by std::vector, so it needs a definition
+const uint64_t CornerMap::emptyKey;
+
+/**
+ * Builds an indexed mesh: corners with the same position and normal share a
+ * vertex. Vertices are numbered in the order their first corner appears in
+ * the file.
+ * @param chunks         parsed chunks in file order; the vertex of every corner
+ *                       is replaced by the index of its vertex in the mesh
+ * @param vertexBuffer   positions of the whole file
+ * @param normalBuffer   normals of the whole file
+ * @param options        load options, for the layout of the mesh (see loadedLayout)
+ * @param postProcessing whether the mesh goes through the optimiser or the simplifier
+ * @param release        free the corners, positions and normals as soon as they
+ *                       are stored; streamOBJ keeps the positions and normals
+ *                       for the following batches
+ * @param mesh           returned mesh
+ */
+static void buildIndexedMesh( std::vector<OBJChunk> &chunks,
+							  std::vector<float4> &vertexBuffer,
+							  std::vector<float3> &normalBuffer,
+							  LoadOptions const &options,
+							  bool postProcessing,
+							  bool release,
+							  Mesh &mesh )
+{
+	std::vector<size_t> cornerOffsets(chunks.size() + 1, 0);
+	for (size_t i = 0; i < chunks.size(); i++) {
+		cornerOffsets[i + 1] = cornerOffsets[i] + chunks[i].corners.size();
+	}
+	size_t indexCount = cornerOffsets[chunks.size()];
+
+	// Every position is usually used with one or a few normals. A part of
+	// the file (see streamOBJ) only uses a few of the positions.
+	size_t expectedVertexCount = std::min(vertexBuffer.size(), indexCount);
+	std::vector<OBJCorner> uniqueCorners;
+	uniqueCorners.reserve(expectedVertexCount);
+
+	// The number of vertices is only known once every corner was looked up, so
+	// the corners keep their vertex index until the mesh is allocated. The map
+	// is freed before that.
+	{
+		CornerMap map(expectedVertexCount);
+		for (size_t i = 0; i < chunks.size(); i++) {
+			for (OBJCorner &corner : chunks[i].corners) {
+				uint32_t vertex = map.findOrInsert(corner, uint32_t(uniqueCorners.size()));
+				if (vertex == uniqueCorners.size()) {
+					uniqueCorners.push_back(corner);
 				}
+				corner.vertex = vertex;
+			}
+		}
+	}
 
-				// Special case for when the file defines quads (4 blocks with face indices)
-				// I know I duplicated the section from above. Please forgive my software maintainability sins..
-				if(lineParts.size() == 5) {
-					for (int i = 1; i <= 4; i++) {
-						if(i == 2) { continue; }
-
-						faceParts.clear();
-						std::string linePart = lineParts.at(i);
-						split(&faceParts, linePart, '/');
-
-						int vertexIndex = std::stoi(faceParts.at(0)) - 1;
-						float4 vertex = vertexBuffer.at(unsigned(vertexIndex));
-						vertices.push_back(vertex);
-
-						int normalIndex = -1;
-
-						if(faceParts.size() == 2) {
-							normalIndex = std::stoi(faceParts.at(1)) - 1;
-						}
-						else if (faceParts.size() == 3 && faceParts.at(1) == "") {
-							normalIndex = std::stoi(faceParts.at(2)) - 1;
-						}
-						else if (faceParts.size() == 3) {
-							normalIndex = std::stoi(faceParts.at(2)) - 1;
-						}
-
-						// (partially) invalid files may contain normals later, or in some cases not at all.
-						// This check accounts for that. If it fails, normals are computed after processing
-						// the contents of the current line in the file
-						if(normalIndex != -1 && normalBuffer.size() > (unsigned int) normalIndex) {
-							normals.push_back(normalBuffer.at(normalIndex));
-						}
-
-						indices.push_back(currentIndex);
-						currentIndex++;
+	mesh.allocate(loadedLayout(uniqueCorners.size(), indexCount, 0, options, postProcessing));
+	if (mesh.quantisedVertices != nullptr) {
+		// The box starts at vertex 0, as in computeBounds
+		float3 lower = vertexBuffer[uniqueCorners[0].vertex].toFloat3();
+		float3 upper = lower;
+		extendBounds(uniqueCorners, vertexBuffer, lower, upper);
+		setQuantisation(mesh, lower, upper);
+	}
+	parallelFor(mesh.vertexCount, [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			OBJCorner const &corner = uniqueCorners[i];
+			storeVertex(mesh, i, vertexBuffer[corner.vertex], cornerNormal(corner, normalBuffer));
+		}
+	});
+	std::vector<OBJCorner>().swap(uniqueCorners);
+	if (release) {
+		std::vector<float4>().swap(vertexBuffer);
+		std::vector<float3>().swap(normalBuffer);
+	}
+
+	parallelFor(chunks.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			size_t index = cornerOffsets[i];
+			for (OBJCorner const &corner : chunks[i].corners) {
+				storeIndex(mesh, index++, corner.vertex);
+			}
+			if (release) {
+				std::vector<OBJCorner>().swap(chunks[i].corners);
+			}
+		}
+	});
+}
+
+/**
+ * Stores a mesh which went through the optimiser or the simplifier in the
+ * layout it is loaded with (see loadedLayout), together with the indices of
+ * its levels of detail. The stored mesh is allocated once, with all its sizes known.
+ * @param mesh       Mesh object with float vertices and 32-bit indices
+ * @param lodIndices indices of the levels of detail of the mesh (see buildLevelsOfDetail)
+ * @param options    load options
+ */
+static void storeLoadedMesh(Mesh &mesh, std::vector<unsigned int> const &lodIndices, LoadOptions const &options)
+{
+	MeshLayout layout = loadedLayout(mesh.vertexCount, mesh.indexCount, lodIndices.size(), options, false);
+	if (!layout.quantised && !layout.shortIndices && !layout.vertexStreams && lodIndices.empty()) {
+		return;
+	}
+
+	Mesh stored;
+	stored.allocate(layout);
+	stored.lods = std::move(mesh.lods);
+	if (layout.quantised) {
+		float3 lower;
+		float3 upper;
+		computeBounds(mesh, lower, upper);
+		setQuantisation(stored, lower, upper);
+	}
+	parallelFor(mesh.vertexCount, [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			storeVertex(stored, i, mesh.vertices[i], mesh.normals[i]);
+		}
+	});
+	parallelFor(mesh.indexCount, [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			storeIndex(stored, i, mesh.indices[i]);
+		}
+	});
+	for (size_t i = 0; i < lodIndices.size(); i++) {
+		if (stored.shortLodIndices != nullptr) {
+			stored.shortLodIndices[i] = uint16_t(lodIndices[i]);
+		} else {
+			stored.lodIndices[i] = lodIndices[i];
+		}
+	}
+	mesh = std::move(stored);
+}
+
+/**
+ * Computes the unit normals of 8 triangles, and the angles at their corners
+ * @param positions positions of the corners, positions[corner][axis] holds one triangle per lane
+ * @param normal    returned unit normals, per axis; zero for triangles without area
+ * @param angles    returned angle at every corner, in radians
+ */
+static void computeTriangleNormals8(float8 const (&positions)[3][3], float8 (&normal)[3], float8 (&angles)[3])
+{
+	float8 edge01[3];
+	float8 edge02[3];
+	float8 edge12[3];
+	for (unsigned int axis = 0; axis < 3; axis++) {
+		edge01[axis] = positions[1][axis] - positions[0][axis];
+		edge02[axis] = positions[2][axis] - positions[0][axis];
+		edge12[axis] = positions[2][axis] - positions[1][axis];
+	}
+
+	// Clamping the squared lengths keeps 1 / sqrt finite, so degenerate
+	// triangles and edges end up with zero vectors instead of NaNs
+	float8 const smallest = {FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN};
+	auto inverseLength = [&](float8 const &lengthSquared, float8 &result) {
+		float8 clamped;
+		select8(lengthSquared > smallest, lengthSquared, smallest, clamped);
+		rsqrt8(clamped, result);
+	};
+	// Vectors are returned through a reference, see simd.hpp
+	auto dot = [](float8 const (&a)[3], float8 const (&b)[3], float8 &result) {
+		result = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	};
+
+	normal[0] = edge01[1] * edge02[2] - edge01[2] * edge02[1];
+	normal[1] = edge01[2] * edge02[0] - edge01[0] * edge02[2];
+	normal[2] = edge01[0] * edge02[1] - edge01[1] * edge02[0];
+	float8 lengthSquared;
+	float8 scale;
+	dot(normal, normal, lengthSquared);
+	inverseLength(lengthSquared, scale);
+	for (unsigned int axis = 0; axis < 3; axis++) {
+		normal[axis] *= scale;
+	}
+
+	float8 length01Squared;
+	float8 length02Squared;
+	float8 length12Squared;
+	dot(edge01, edge01, length01Squared);
+	dot(edge02, edge02, length02Squared);
+	dot(edge12, edge12, length12Squared);
+	float8 cosines[3];
+	dot(edge01, edge02, cosines[0]);
+	dot(edge01, edge12, cosines[1]);
+	dot(edge02, edge12, cosines[2]);
+	// The angle at corner 1 lies between the edges 1-0 and 1-2
+	cosines[1] = -cosines[1];
+	inverseLength(length01Squared * length02Squared, scale);
+	cosines[0] *= scale;
+	inverseLength(length01Squared * length12Squared, scale);
+	cosines[1] *= scale;
+	inverseLength(length02Squared * length12Squared, scale);
+	cosines[2] *= scale;
+	for (unsigned int corner = 0; corner < 3; corner++) {
+		acos8(cosines[corner], angles[corner]);
+	}
+}
+
+/**
+ * Gives the corners of a mesh generated normals: either the normal of their
+ * triangle (flat), or the average of the normals of all triangles around
+ * their position, weighted by the angle of each triangle at that position
+ * (smooth). Generated normals are appended to the normal buffer, and the
+ * corners point to them.
+ * @param chunks       parsed chunks; their corners are updated
+ * @param vertexBuffer positions of the whole file
+ * @param normalBuffer normals of the whole file, the generated ones are appended
+ * @param mode         which corners get which normals
+ */
+static void generateNormals( std::vector<OBJChunk> &chunks,
+							 std::vector<float4> const &vertexBuffer,
+							 std::vector<float3> &normalBuffer,
+							 NormalGeneration const mode )
+{
+	std::vector<size_t> cornerOffsets(chunks.size() + 1, 0);
+	bool normalsMissing = false;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		cornerOffsets[i + 1] = cornerOffsets[i] + chunks[i].corners.size();
+		normalsMissing = normalsMissing || chunks[i].cornersWithNormal != chunks[i].corners.size();
+	}
+	if (mode == NormalGeneration::Missing && !normalsMissing) {
+		return;
+	}
+	bool smooth = mode != NormalGeneration::Flat;
+	size_t cornerCount = cornerOffsets[chunks.size()];
+	size_t triangleCount = cornerCount / 3;
+
+	// Positions of all corners in one array; triangles never cross chunks
+	std::vector<uint32_t> cornerPositions(cornerCount);
+	parallelFor(chunks.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			for (size_t j = 0; j < chunks[i].corners.size(); j++) {
+				cornerPositions[cornerOffsets[i] + j] = chunks[i].corners[j].vertex;
+			}
+		}
+	});
+
+	// Triangle normals, 8 triangles at a time. Smooth normals need the normal
+	// weighted by the angle at every corner, flat normals one per triangle.
+	std::vector<float3> generatedNormals(smooth ? cornerCount : triangleCount);
+	size_t groupCount = (triangleCount + 7) / 8;
+	parallelFor(groupCount, [&](size_t begin, size_t end, unsigned int) {
+		for (size_t group = begin; group < end; group++) {
+			size_t firstTriangle = group * 8;
+			size_t laneCount = std::min(size_t(8), triangleCount - firstTriangle);
+
+			float8 positions[3][3] = {};
+			for (size_t lane = 0; lane < laneCount; lane++) {
+				for (unsigned int corner = 0; corner < 3; corner++) {
+					float4 const &position = vertexBuffer[cornerPositions[3 * (firstTriangle + lane) + corner]];
+					positions[corner][0][lane] = position.x;
+					positions[corner][1][lane] = position.y;
+					positions[corner][2][lane] = position.z;
+				}
+			}
+
+			float8 normal[3];
+			float8 angles[3];
+			computeTriangleNormals8(positions, normal, angles);
+
+			for (size_t lane = 0; lane < laneCount; lane++) {
+				float3 triangleNormal = make_float3(normal[0][lane], normal[1][lane], normal[2][lane]);
+				if (smooth) {
+					for (unsigned int corner = 0; corner < 3; corner++) {
+						float angle = angles[corner][lane];
+						generatedNormals[3 * (firstTriangle + lane) + corner] =
+							make_float3(triangleNormal.x * angle, triangleNormal.y * angle, triangleNormal.z * angle);
 					}
+				} else {
+					generatedNormals[firstTriangle + lane] = triangleNormal;
+				}
+			}
+		}
+	});
+
+	// Index of the generated normal of every corner
+	std::vector<uint32_t> cornerNormals(cornerCount);
+	size_t normalCount;
+	if (smooth) {
+		// Numbers the positions the corners use, in order of first use
+		CornerMap map(std::min(vertexBuffer.size(), cornerCount));
+		size_t positionCount = 0;
+		for (size_t i = 0; i < cornerCount; i++) {
+			OBJCorner key;
+			key.vertex = cornerPositions[i];
+			key.normal = 0;
+			cornerNormals[i] = map.findOrInsert(key, uint32_t(positionCount));
+			if (cornerNormals[i] == positionCount) {
+				positionCount++;
+			}
+		}
+
+		// Corners around every position, in file order so that the sums do not
+		// depend on the number of threads
+		std::vector<size_t> positionOffsets(positionCount + 1, 0);
+		for (size_t i = 0; i < cornerCount; i++) {
+			positionOffsets[cornerNormals[i] + 1]++;
+		}
+		for (size_t i = 0; i < positionCount; i++) {
+			positionOffsets[i + 1] += positionOffsets[i];
+		}
+		std::vector<uint32_t> positionCorners(cornerCount);
+		std::vector<size_t> fill(positionOffsets.begin(), positionOffsets.end() - 1);
+		for (size_t i = 0; i < cornerCount; i++) {
+			positionCorners[fill[cornerNormals[i]]++] = uint32_t(i);
+		}
+
+		std::vector<float3> positionNormals(positionCount);
+		parallelFor(positionCount, [&](size_t begin, size_t end, unsigned int) {
+			for (size_t i = begin; i < end; i++) {
+				float3 sum = make_float3(0, 0, 0);
+				for (size_t j = positionOffsets[i]; j < positionOffsets[i + 1]; j++) {
+					float3 const &weighted = generatedNormals[positionCorners[j]];
+					sum.x += weighted.x;
+					sum.y += weighted.y;
+					sum.z += weighted.z;
 				}
+				float lengthSquared = sum.x * sum.x + sum.y * sum.y + sum.z * sum.z;
+				positionNormals[i] = lengthSquared > 0 ? normalize(sum) : sum;
+			}
+		});
+		generatedNormals.swap(positionNormals);
+		normalCount = positionCount;
+	} else {
+		for (size_t i = 0; i < cornerCount; i++) {
+			cornerNormals[i] = uint32_t(i / 3);
+		}
+		normalCount = triangleCount;
+	}
 
+	size_t normalOffset = normalBuffer.size();
+	if (normalOffset + normalCount >= OBJCorner::noNormal) {
+		throw std::runtime_error("Too many normals to generate");
+	}
+	normalBuffer.insert(normalBuffer.end(), generatedNormals.begin(), generatedNormals.end());
 
-				// If the file incorrectly or was missing normals, we compute them here.
-				// Alternatively, we override those present in the file if this was mandated by the use.
+	parallelFor(chunks.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			for (size_t j = 0; j < chunks[i].corners.size(); j++) {
+				OBJCorner &corner = chunks[i].corners[j];
+				if (mode != NormalGeneration::Missing || corner.normal == OBJCorner::noNormal) {
+					corner.normal = uint32_t(normalOffset + cornerNormals[cornerOffsets[i] + j]);
+				}
 			}
+			chunks[i].cornersWithNormal = chunks[i].corners.size();
 		}
+	});
+}
 
-        unsigned int faceCount = unsigned(indices.size()) / 3;
+/**
+ * Text of an OBJ file: the mapped file itself, or its decompressed contents
+ */
+typedef struct OBJText {
+	std::unique_ptr<MappedFile> file;
+	DecompressedData decompressed;
+	char const *begin;
+	char const *end;
+} OBJText;
 
-		float4* meshVertexBuffer = new float4[vertices.size()];
-		std::copy(vertices.begin(), vertices.end(), meshVertexBuffer);
+/**
+ * Maps an OBJ file without decompressing it
+ * @param src  path of the file
+ * @param text returned contents of the file
+ */
+static void mapOBJ(std::string const &src, OBJText &text)
+{
+	try {
+		text.file.reset(new MappedFile(src));
+	} catch (std::runtime_error const &) {
+		throw std::runtime_error("Reading OBJ file failed. This is usually because the operating system can't find it. Check if the relative path (to your terminal's working directory) is correct.");
+	}
+	text.begin = text.file->begin();
+	text.end = text.file->end();
+}
 
-		float3* meshNormalBuffer = new float3[normals.size()];
-		std::copy(normals.begin(), normals.end(), meshNormalBuffer);
+/**
+ * Opens an OBJ file, and decompresses it whole if it is gzip or zlib
+ * compressed (see compressedFile.hpp), as the chunks of the parallel parser
+ * need all of the text
+ * @param src  path of the file
+ * @param text returned text of the file
+ */
+static void openOBJ(std::string const &src, OBJText &text)
+{
+	mapOBJ(src, text);
+	if (isCompressed(text.begin, text.end)) {
+		try {
+			decompress(text.begin, text.end, text.decompressed);
+		} catch (std::runtime_error const &error) {
+			throw std::runtime_error(error.what() + std::string(" in '") + src + "'.");
+		}
+		// Only the decompressed text is parsed
+		text.file.reset();
+		text.begin = text.decompressed.begin();
+		text.end = text.decompressed.end();
+	}
+}
 
-		unsigned int* meshIndexBuffer = new unsigned int[3 * faceCount];
-		std::copy(indices.begin(), indices.end(), meshIndexBuffer);
+/**
+ * Calls function(lineBegin, lineEnd) for every line of a gzip or zlib
+ * compressed OBJ file, until it returns false. The file is inflated into a
+ * window of inflateWindowSize bytes at a time, which only grows for a line
+ * longer than it, so the text is never held whole.
+ * @param src      path of the file, for error messages
+ * @param begin    start of the compressed file
+ * @param end      end of the compressed file
+ * @param function callable with signature bool(char const *, char const *)
+ */
+template <typename Function>
+static void forEachCompressedLine(std::string const &src, char const *begin, char const *end, Function function)
+{
+	auto decompressionError = [&](std::runtime_error const &error) {
+		return std::runtime_error(error.what() + std::string(" in '") + src + "'.");
+	};
+	std::unique_ptr<InflateStream> stream;
+	try {
+		stream.reset(new InflateStream(begin, end));
+	} catch (std::runtime_error const &error) {
+		throw decompressionError(error);
+	}
 
-		objFile.close();
+	std::vector<char> window(inflateWindowSize);
+	// Bytes at the start of the window, the start of a line which did not
+	// fit in the previous window
+	size_t carried = 0;
+	bool ended = false;
+	while (!ended) {
+		if (carried == window.size()) {
+			window.resize(2 * window.size());
+		}
+		try {
+			carried += stream->read(window.data() + carried, window.size() - carried);
+			ended = stream->finished();
+		} catch (std::runtime_error const &error) {
+			throw decompressionError(error);
+		}
 
-		Mesh mesh;
+		// Only whole lines are parsed until the text ends
+		char const *textEnd = window.data() + carried;
+		char const *linesEnd = textEnd;
+		if (!ended) {
+			while (linesEnd != window.data() && linesEnd[-1] != '\n') {
+				linesEnd--;
+			}
+		}
+		bool more = true;
+		forEachLine(window.data(), linesEnd, [&](char const *lineBegin, char const *lineEnd) {
+			more = function(lineBegin, lineEnd);
+			return more;
+		});
+		if (!more) {
+			return;
+		}
+		carried = size_t(textEnd - linesEnd);
+		std::memmove(window.data(), linesEnd, carried);
+	}
+}
+
+/**
+ * Parses an OBJ file
+ * @param  src            path of the file
+ * @param  options        load options
+ * @param  postProcessing whether the mesh goes through the optimiser or the
+ *                        simplifier, see loadedLayout
+ * @return                the mesh
+ */
+static Mesh parseOBJ(std::string const &src, LoadOptions const &options, bool postProcessing)
+{
+	OBJText file;
+	openOBJ(src, file);
+
+	std::vector<OBJChunk> chunks = splitChunks(file.begin, file.end, workerThreadCount());
+
+	parallelFor(chunks.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			parseDeclarations(chunks[i]);
+		}
+	});
+
+	// Faces after an error in the declarations are never reached by a serial
+	// parser, so only the chunks up to the first failed one are resolved.
+	size_t chunkCount = chunks.size();
+	for (size_t i = 0; i < chunks.size(); i++) {
+		if (chunks[i].failed) {
+			chunkCount = i + 1;
+			break;
+		}
+	}
+	chunks.resize(chunkCount);
+
+	std::vector<size_t> vertexOffsets(chunkCount + 1, 0);
+	std::vector<size_t> normalOffsets(chunkCount + 1, 0);
+	std::vector<size_t> lineOffsets(chunkCount + 1, 0);
+	for (size_t i = 0; i < chunkCount; i++) {
+		vertexOffsets[i + 1] = vertexOffsets[i] + chunks[i].vertexBuffer.size();
+		normalOffsets[i + 1] = normalOffsets[i] + chunks[i].normalBuffer.size();
+		lineOffsets[i + 1] = lineOffsets[i] + chunks[i].lineCount;
+	}
 
-		mesh.vertices = meshVertexBuffer;
-		mesh.normals = meshNormalBuffer;
+	// Corners store 32-bit indices, the largest one marks a missing normal
+	if (vertexOffsets[chunkCount] >= OBJCorner::noNormal || normalOffsets[chunkCount] >= OBJCorner::noNormal) {
+		throw std::runtime_error("'" + src + "' has too many vertices or normals.");
+	}
 
-		mesh.indices = meshIndexBuffer;
+	std::vector<float4> vertexBuffer(vertexOffsets[chunkCount]);
+	std::vector<float3> normalBuffer(normalOffsets[chunkCount]);
+	concatenate(chunks, &OBJChunk::vertexBuffer, vertexBuffer.data());
+	concatenate(chunks, &OBJChunk::normalBuffer, normalBuffer.data());
+	// The copies per chunk would otherwise double the positions and normals held until the mesh is built
+	for (OBJChunk &chunk : chunks) {
+		std::vector<float4>().swap(chunk.vertexBuffer);
+		std::vector<float3>().swap(chunk.normalBuffer);
+	}
+
+	parallelFor(chunkCount, [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; i++) {
+			OBJFaceParser parser(chunks[i], vertexOffsets[i], normalOffsets[i], vertexBuffer.data());
+			parser.parseFaces(chunks[i].failed ? chunks[i].errorLineBegin : chunks[i].end);
+		}
+	});
+
+	for (size_t i = 0; i < chunkCount; i++) {
+		if (chunks[i].failed) {
+			throw std::runtime_error(chunks[i].errorMessage + " on line " + std::to_string(lineOffsets[i] + chunks[i].errorLine) +
+									 " of '" + src + "'.");
+		}
+	}
 
-		mesh.vertexCount = 3 * faceCount;
-		mesh.indexCount = 3 * faceCount;
+	// Everything the mesh needs from the text is in the corners and buffers now
+	file.file.reset();
+	file.decompressed.data.reset();
 
+	generateNormals(chunks, vertexBuffer, normalBuffer, options.normals);
+
+	Mesh mesh;
+	if (options.deindexed) {
+		buildDeindexedMesh(chunks, vertexBuffer, normalBuffer, options, postProcessing, true, mesh);
+	} else {
+		buildIndexedMesh(chunks, vertexBuffer, normalBuffer, options, postProcessing, true, mesh);
+	}
+	return mesh;
+}
+
+void computeBounds(Mesh const &mesh, float3 &lower, float3 &upper)
+{
+	lower = mesh.position(0).toFloat3();
+	upper = lower;
+	size_t i = 1;
+	if (mesh.streams.x != nullptr && mesh.vertexCount >= 8) {
+		float const *coordinates[3] = {mesh.streams.x, mesh.streams.y, mesh.streams.z};
+		float8 lanesLower[3];
+		float8 lanesUpper[3];
+		for (unsigned int axis = 0; axis < 3; axis++) {
+			std::memcpy(&lanesLower[axis], coordinates[axis], sizeof(float8));
+			lanesUpper[axis] = lanesLower[axis];
+		}
+		for (i = 8; i + 8 <= mesh.vertexCount; i += 8) {
+			for (unsigned int axis = 0; axis < 3; axis++) {
+				float8 values;
+				std::memcpy(&values, coordinates[axis] + i, sizeof(float8));
+				select8(values < lanesLower[axis], values, lanesLower[axis], lanesLower[axis]);
+				select8(values > lanesUpper[axis], values, lanesUpper[axis], lanesUpper[axis]);
+			}
+		}
+		for (unsigned int lane = 0; lane < 8; lane++) {
+			lower = make_float3(std::min(lower.x, lanesLower[0][lane]), std::min(lower.y, lanesLower[1][lane]), std::min(lower.z, lanesLower[2][lane]));
+			upper = make_float3(std::max(upper.x, lanesUpper[0][lane]), std::max(upper.y, lanesUpper[1][lane]), std::max(upper.z, lanesUpper[2][lane]));
+		}
+	}
+	for (; i < mesh.vertexCount; i++) {
+		float4 vertex = mesh.position(i);
+		lower = make_float3(std::min(lower.x, vertex.x), std::min(lower.y, vertex.y), std::min(lower.z, vertex.z));
+		upper = make_float3(std::max(upper.x, vertex.x), std::max(upper.y, vertex.y), std::max(upper.z, vertex.z));
+	}
+}
+
+Mesh loadOBJ(std::string src, LoadOptions const &options, MeshOptimisationReport *report)
+{
+	Mesh mesh;
+	if (options.meshCache && readMeshCache(src, options, mesh)) {
 		return mesh;
 	}
-	else {
-		throw std::runtime_error("Reading OBJ file failed. This is usually because the operating system can't find it. Check if the relative path (to your terminal's working directory) is correct.");
+	// The optimiser and the simplifier work on float vertices and 32-bit
+	// indices, the mesh gets its final layout after them
+	bool postProcessing = options.optimise || options.levelsOfDetail;
+	mesh = parseOBJ(src, options, postProcessing);
+	if (postProcessing) {
+		if (options.optimise) {
+			optimiseMesh(mesh, report);
+		}
+		std::vector<unsigned int> lodIndices;
+		if (options.levelsOfDetail) {
+			buildLevelsOfDetail(mesh, lodIndices);
+		}
+		storeLoadedMesh(mesh, lodIndices, options);
+	}
+	if (options.meshCache) {
+		writeMeshCache(src, options, mesh);
+	}
+	return mesh;
+}
+
+void streamOBJ(std::string src, LoadOptions const &options, size_t batchTriangleCount, BoundedQueue<Mesh> &queue)
+{
+	// A cached mesh is available at once, as a single batch
+	Mesh cachedMesh;
+	if (options.meshCache && readMeshCache(src, options, cachedMesh)) {
+		queue.push(std::move(cachedMesh));
+		return;
 	}
-}
\ No newline at end of file
+
+	// A compressed file is inflated while it is parsed
+	OBJText file;
+	mapOBJ(src, file);
+
+	// Faces may use any position or normal declared before them, so those are
+	// kept until the end. The corners of the faces are handed off in batches.
+	std::vector<OBJChunk> batch(1);
+	std::vector<float4> vertexBuffer;
+	std::vector<float3> normalBuffer;
+	OBJFaceParser parser(batch[0], 0, 0, nullptr);
+	size_t const batchCornerCount = 3 * std::max(batchTriangleCount, size_t(1));
+	batch[0].corners.reserve(batchCornerCount + 3);
+	bool stopped = false;
+
+	auto sendBatch = [&]() {
+		// Normals are generated from the triangles of the batch alone, and are
+		// not needed by later batches
+		size_t declaredNormalCount = normalBuffer.size();
+		generateNormals(batch, vertexBuffer, normalBuffer, options.normals);
+		Mesh mesh;
+		if (options.deindexed) {
+			buildDeindexedMesh(batch, vertexBuffer, normalBuffer, options, false, false, mesh);
+		} else {
+			buildIndexedMesh(batch, vertexBuffer, normalBuffer, options, false, false, mesh);
+		}
+		normalBuffer.resize(declaredNormalCount);
+		batch[0].corners.clear();
+		batch[0].cornersWithNormal = 0;
+		// The consumer closes the queue when it stops early
+		if (!queue.push(std::move(mesh))) {
+			stopped = true;
+		}
+	};
+
+	size_t lineNumber = 0;
+	auto parseLine = [&](char const *lineBegin, char const *lineEnd) {
+		lineNumber++;
+		char const *c = lineBegin;
+		try {
+			OBJKeyword keyword = readKeyword(c, lineEnd);
+			if (keyword == OBJKeyword::Vertex) {
+				float3 position;
+				parseCoordinates(c, lineEnd, position);
+				float4 vertex;
+				vertex.x = position.x;
+				vertex.y = position.y;
+				vertex.z = position.z;
+				vertex.w = 1;
+				vertexBuffer.push_back(vertex);
+				parser.vertexCount++;
+			} else if (keyword == OBJKeyword::Normal) {
+				float3 normal;
+				parseCoordinates(c, lineEnd, normal);
+				normalBuffer.push_back(normal);
+				parser.normalCount++;
+			} else if (keyword == OBJKeyword::Face) {
+				// The positions move while the file is read
+				parser.positions = vertexBuffer.data();
+				parser.parseFace(c, lineEnd);
+			}
+			// Corners store 32-bit indices, the largest one marks a missing normal
+			if (vertexBuffer.size() >= OBJCorner::noNormal || normalBuffer.size() >= OBJCorner::noNormal) {
+				throw std::runtime_error("Too many vertices or normals");
+			}
+		} catch (std::runtime_error const &error) {
+			throw std::runtime_error(error.what() + std::string(" on line ") + std::to_string(lineNumber) + " of '" + src + "'.");
+		}
+		if (batch[0].corners.size() >= batchCornerCount) {
+			sendBatch();
+		}
+		return !stopped;
+	};
+	if (isCompressed(file.begin, file.end)) {
+		forEachCompressedLine(src, file.begin, file.end, parseLine);
+	} else {
+		forEachLine(file.begin, file.end, parseLine);
+	}
+
+	if (!stopped && !batch[0].corners.empty()) {
+		sendBatch();
+	}
+}
@@ -1,36 +1,278 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <limits>
+#include <memory>
 
 #include "geom.hpp"
+#include "boundedQueue.hpp"
+#include "meshOptimiser.hpp"
+#include "meshSimplifier.hpp"
+#include "meshQuantiser.hpp"
 
+struct MappedFile;
+
+// Structure of arrays copy of the float vertices and normals of a mesh: every
+// coordinate in an array of its own, so 8-wide code reads 8 vertices with one
+// load per coordinate instead of shuffling float4s (see LoadOptions::vertexStreams).
+// The six arrays follow each other in one block, 64-byte aligned and padded
+// to a multiple of 16 floats each.
+typedef struct VertexStreams {
+	float* x;
+	float* y;
+	float* z;
+	float* normalX;
+	float* normalY;
+	float* normalZ;
+
+	VertexStreams() {
+		x = nullptr;
+		y = nullptr;
+		z = nullptr;
+		normalX = nullptr;
+		normalY = nullptr;
+		normalZ = nullptr;
+	}
+
+	/**
+	 * @return number of floats from the start of one array to the next
+	 */
+	static size_t stride(size_t vertexCount) {
+		return (vertexCount + 15) / 16 * 16;
+	}
+
+	/**
+	 * Points the arrays into a block of 6 * stride(vertexCount) floats
+	 */
+	void assign(float *block, size_t vertexCount) {
+		size_t step = stride(vertexCount);
+		x = block;
+		y = block + step;
+		z = block + 2 * step;
+		normalX = block + 3 * step;
+		normalY = block + 4 * step;
+		normalZ = block + 5 * step;
+	}
+
+	/**
+	 * Stores the position and normal of a vertex
+	 */
+	void write(size_t vertex, float4 const &position, float3 const &normal) {
+		x[vertex] = position.x;
+		y[vertex] = position.y;
+		z[vertex] = position.z;
+		normalX[vertex] = normal.x;
+		normalY[vertex] = normal.y;
+		normalZ[vertex] = normal.z;
+	}
+} VertexStreams;
+
+// Sizes and formats of the arrays of a mesh (see Mesh::allocate)
+typedef struct MeshLayout {
+	size_t vertexCount;
+	// Float normals; a quantised mesh has none
+	size_t normalCount;
+	size_t indexCount;
+	size_t lodIndexCount;
+	// Quantised vertices instead of float vertices and normals
+	bool quantised;
+	// 16-bit instead of 32-bit index buffers
+	bool shortIndices;
+	// Vertex streams next to the float vertices and normals, which requires
+	// as many normals as vertices. A quantised mesh has none.
+	bool vertexStreams;
+
+	MeshLayout() {
+		vertexCount = 0;
+		normalCount = 0;
+		indexCount = 0;
+		lodIndexCount = 0;
+		quantised = false;
+		shortIndices = false;
+		vertexStreams = false;
+	}
+} MeshLayout;
+
+// A mesh owns its arrays, and is moved rather than copied. The arrays either
+// share one 64-byte aligned allocation (see allocate), or point into a mapped
+// mesh cache file. A mesh which owns neither is a view of the arrays of
+// another mesh, and must not outlive it.
 typedef struct Mesh {
 	float4* vertices;
 	float3* normals;
+	// Set next to vertices and normals when the mesh was loaded with vertex streams
+	VertexStreams streams;
 
+	// 32-bit index buffer, or nullptr when the indices fit in 16 bits and are
+	// stored in shortIndices instead (at most 65536 vertices)
 	unsigned int* indices;
+	uint16_t* shortIndices;
 
 	size_t vertexCount;
+	size_t normalCount;
 	size_t indexCount;
 
+	// Set instead of vertices and normals when the mesh was quantised (see
+	// meshQuantiser.hpp). Positions are quantisationOffset + q * quantisationScale.
+	QuantisedVertex* quantisedVertices;
+	float3 quantisationOffset;
+	float3 quantisationScale;
+
+	// Coarser levels of detail, from fine to coarse, which index the same
+	// vertices (see meshSimplifier.hpp). Level 0 is the mesh itself and has
+	// no entry; a mesh loaded without levels of detail has none at all.
+	// Stored with the same width as the indices of the mesh
+	unsigned int* lodIndices;
+	uint16_t* shortLodIndices;
+	size_t lodIndexCount;
+	std::vector<MeshLOD> lods;
+
+	// Owner of the arrays: the allocation made by allocate, or the mapped mesh cache file
+	std::unique_ptr<char[]> arena;
+	std::shared_ptr<MappedFile> storage;
+
 	Mesh() {
 		vertices = nullptr;
 		normals = nullptr;
 		indices = nullptr;
+		shortIndices = nullptr;
 		vertexCount = 0;
+		normalCount = 0;
 		indexCount = 0;
+		lodIndices = nullptr;
+		shortLodIndices = nullptr;
+		lodIndexCount = 0;
+		quantisedVertices = nullptr;
+		quantisationOffset = make_float3(0, 0, 0);
+		quantisationScale = make_float3(0, 0, 0);
+	}
+
+	Mesh(Mesh &&other) = default;
+	Mesh &operator=(Mesh &&other) = default;
+	Mesh(Mesh const &) = delete;
+	Mesh &operator=(Mesh const &) = delete;
+
+	/**
+	 * @return entry of the index buffer, of either width
+	 */
+	unsigned int index(size_t i) const {
+		return shortIndices != nullptr ? shortIndices[i] : indices[i];
+	}
+
+	/**
+	 * @return position of a vertex, also of a quantised mesh
+	 */
+	float4 position(size_t vertex) const {
+		return quantisedVertices != nullptr ? dequantisePosition(quantisedVertices[vertex], quantisationOffset, quantisationScale) : vertices[vertex];
 	}
 
-	void deleteMesh() {
-		delete[] vertices;
-		delete[] normals;
-		delete[] indices;
+	/**
+	 * @return normal of a vertex, also of a quantised mesh
+	 */
+	float3 normal(size_t vertex) const {
+		return quantisedVertices != nullptr ? dequantiseNormal(quantisedVertices[vertex]) : normals[vertex];
 	}
+
+	/**
+	 * @return sizes and formats of the arrays of the mesh
+	 */
+	MeshLayout layout() const;
+
+	/**
+	 * Replaces the arrays of the mesh by uninitialised arrays with the given
+	 * layout, which share one 64-byte aligned allocation. Sets the counts of
+	 * the mesh; the levels of detail and quantisation parameters are kept.
+	 * @param layout sizes and formats of the arrays
+	 */
+	void allocate(MeshLayout const &layout);
 } Mesh;
 
-Mesh loadOBJ(std::string src);
\ No newline at end of file
+// Which corners of the mesh get generated normals
+enum class NormalGeneration {
+	// Only corners without a normal in the file, with smooth normals
+	Missing,
+	// All corners: the angle-weighted average of the triangles around their position
+	Smooth,
+	// All corners: the normal of their triangle
+	Flat
+};
+
+typedef struct LoadOptions {
+	// Give every corner of every triangle a vertex of its own, instead of sharing
+	// the vertices of corners with the same position and normal
+	bool deindexed;
+	// Store the parsed mesh in a binary cache file next to the OBJ file, and
+	// map that file on later loads as long as the OBJ file does not change
+	bool meshCache;
+	// Normals generated from the triangles, for files without (complete) normals
+	NormalGeneration normals;
+	// Reorder the triangles and vertices for the vertex cache and for less
+	// overdraw (see meshOptimiser.hpp). The reordered mesh is cached.
+	bool optimise;
+	// Build coarser levels of detail of the mesh (see meshSimplifier.hpp),
+	// which are cached with it
+	bool levelsOfDetail;
+	// Store the vertices in the 12 byte quantised layout (see meshQuantiser.hpp)
+	bool quantised;
+	// Also store the vertices and normals as vertex streams (see VertexStreams),
+	// unless they are quantised
+	bool vertexStreams;
+
+	LoadOptions() {
+		deindexed = false;
+		meshCache = true;
+		normals = NormalGeneration::Missing;
+		optimise = false;
+		levelsOfDetail = false;
+		quantised = false;
+		vertexStreams = false;
+	}
+} LoadOptions;
+
+/**
+ * Computes the bounding box of the vertices of a mesh, 8 vertices at a time
+ * when the mesh has vertex streams
+ * @param mesh  Mesh object with at least one vertex
+ * @param lower returned lower corner
+ * @param upper returned upper corner
+ */
+void computeBounds(Mesh const &mesh, float3 &lower, float3 &upper);
+
+/**
+ * Loads a triangle mesh from an OBJ file. A mesh with at most 65536 vertices
+ * gets 16-bit indices (see Mesh::shortIndices).
+ * @param  src     path of the file
+ * @param  options load options
+ * @param  report  if not null, returns the statistics of the optimisation
+ *                 (see LoadOptions::optimise)
+ * @return         the mesh
+ */
+Mesh loadOBJ(std::string src, LoadOptions const &options = LoadOptions(), MeshOptimisationReport *report = nullptr);
+
+/**
+ * Loads a triangle mesh from an OBJ file in batches, so that the batches
+ * loaded first can be rendered while the rest of the file is parsed. Every
+ * batch is a mesh of its own with (up to) batchTriangleCount triangles, in
+ * file order. A valid mesh cache is pushed as a single batch; a mesh loaded
+ * this way is not written to the cache, is not optimised, and has no levels
+ * of detail; every batch is quantised on its own.
+ *
+ * Generated normals (see LoadOptions::normals) are computed from the
+ * triangles of each batch alone. Flat normals are the same as those of
+ * loadOBJ. A smooth normal at a position shared by triangles of two batches
+ * only averages the triangles of its own batch, so smooth shading shows a
+ * seam along the borders of the batches.
+ *
+ * The queue is not closed when loading finishes, and loading stops early when
+ * the consumer closes it.
+ * @param src                path of the file
+ * @param options            load options
+ * @param batchTriangleCount number of triangles per batch
+ * @param queue              returned batches
+ */
+void streamOBJ(std::string src, LoadOptions const &options, size_t batchTriangleCount, BoundedQueue<Mesh> &queue);
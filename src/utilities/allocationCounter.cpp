@@ -0,0 +1,42 @@
+#include "allocationCounter.hpp"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> allocationCount(0);
+static thread_local size_t threadAllocationCount = 0;
+
+size_t heapAllocationCount() {
+	return allocationCount.load();
+}
+
+size_t threadHeapAllocationCount() {
+	return threadAllocationCount;
+}
+
+void *operator new(std::size_t size) {
+	allocationCount++;
+	threadAllocationCount++;
+	void *pointer = std::malloc(size == 0 ? 1 : size);
+	if (pointer == nullptr) {
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void *operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept {
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+	std::free(pointer);
+}
+
+#endif
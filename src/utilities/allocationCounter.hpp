@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+// When the renderer is built with -DCOUNT_ALLOCATIONS (make DEFINES=-DCOUNT_ALLOCATIONS,
+// which make test and the cpurender_allocations target of cmake do),
+// the global operator new is replaced by one that counts every heap allocation.
+// The rasteriser uses it to verify that its hot path does not allocate.
+
+#ifdef COUNT_ALLOCATIONS
+/**
+ * @return number of calls to the global operator new so far, from all threads
+ */
+size_t heapAllocationCount();
+
+/**
+ * @return number of calls to the global operator new so far, from the calling thread
+ */
+size_t threadHeapAllocationCount();
+#endif
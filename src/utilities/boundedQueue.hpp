@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * Queue between a producer and a consumer thread which holds at most a fixed
+ * number of items. A producer which gets ahead of its consumer waits, so the
+ * memory held by the queue stays bounded.
+ *
+ * Either side may close the queue: the producer when it has nothing more to
+ * push, the consumer when it stops early. Items pushed before the queue was
+ * closed can still be popped.
+ */
+template <typename T>
+struct BoundedQueue {
+	explicit BoundedQueue(size_t capacity) {
+		this->capacity = capacity == 0 ? 1 : capacity;
+		closed = false;
+	}
+
+	/**
+	 * Adds an item, waiting while the queue is full
+	 * @param  item item to add
+	 * @return      false if the queue was closed, the item is not added then
+	 */
+	bool push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [&]() { return closed || items.size() < capacity; });
+		if (closed) {
+			return false;
+		}
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	/**
+	 * Removes the oldest item, waiting while the queue is empty
+	 * @param  item returned item
+	 * @return      false if the queue is closed and empty
+	 */
+	bool pop(T &item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [&]() { return closed || !items.empty(); });
+		if (items.empty()) {
+			return false;
+		}
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	/**
+	 * Wakes up both sides: later pushes fail, and pops fail once the queue is empty
+	 */
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed;
+};
@@ -0,0 +1,570 @@
+#include "compressedFile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const unsigned char gzipMagic[2] = {0x1F, 0x8B};
+// Deflate is the only compression method of both formats
+static const unsigned char deflateMethod = 8;
+
+// Flags of a gzip header, which announce optional fields
+static const unsigned char gzipHeaderCRC = 2;
+static const unsigned char gzipExtra = 4;
+static const unsigned char gzipName = 8;
+static const unsigned char gzipComment = 16;
+
+// Flag of a zlib header for a preset dictionary, which files do not use
+static const unsigned char zlibDictionary = 32;
+
+// Back references reach at most 32 KB back
+static const size_t windowSize = 32768;
+
+// Base values and extra bits of the length and distance codes (RFC 1951, section 3.2.5)
+static const uint16_t lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char lengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char distanceExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order in which a dynamic block stores the lengths of the code length code
+static const unsigned char codeLengthOrder[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/**
+ * @throws std::runtime_error with the given reason
+ */
+[[noreturn]] static void fail(char const *reason)
+{
+	throw std::runtime_error(std::string("Decompressing failed: ") + reason);
+}
+
+/**
+ * @return whether the contents start with a gzip header
+ */
+static bool isGzip(unsigned char const *data, size_t size)
+{
+	return size >= 3 && data[0] == gzipMagic[0] && data[1] == gzipMagic[1] && data[2] == deflateMethod;
+}
+
+/**
+ * @return whether the contents start with a zlib header with a 32 KB window,
+ *         which is what zlib writes; smaller windows would also match
+ *         ordinary text
+ */
+static bool isZlib(unsigned char const *data, size_t size)
+{
+	return size >= 2 && data[0] == 0x78 && (data[0] * 256 + data[1]) % 31 == 0;
+}
+
+/**
+ * Continues the CRC-32 of gzip over more data
+ * @param  crc  CRC-32 of the data before, 0 at the start
+ * @param  data next data
+ * @param  size size of the data
+ * @return      CRC-32 of all data so far
+ */
+static uint32_t updateCRC32(uint32_t crc, unsigned char const *data, size_t size)
+{
+	struct Table {
+		uint32_t entries[256];
+
+		Table() {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t value = i;
+				for (unsigned int bit = 0; bit < 8; bit++) {
+					value = (value & 1) != 0 ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+				}
+				entries[i] = value;
+			}
+		}
+	};
+	static Table const table;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+/**
+ * Continues the Adler-32 of zlib over more data
+ * @param  adler Adler-32 of the data before, 1 at the start
+ * @param  data  next data
+ * @param  size  size of the data
+ * @return       Adler-32 of all data so far
+ */
+static uint32_t updateAdler32(uint32_t adler, unsigned char const *data, size_t size)
+{
+	uint32_t const modulus = 65521;
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (size > 0) {
+		// The sums can not overflow within 5552 bytes
+		size_t count = std::min(size, size_t(5552));
+		for (size_t i = 0; i < count; i++) {
+			a += data[i];
+			b += a;
+		}
+		a %= modulus;
+		b %= modulus;
+		data += count;
+		size -= count;
+	}
+	return b << 16 | a;
+}
+
+/**
+ * Canonical Huffman code of a deflate block (RFC 1951, section 3.2.2). Codes
+ * of up to fastBits bits are decoded with a single table lookup, longer ones
+ * bit by bit.
+ */
+typedef struct HuffmanCode {
+	static const unsigned int maxBits = 15;
+	static const unsigned int fastBits = 10;
+
+	// Number of codes of every length, and the symbols ordered by code
+	uint16_t counts[maxBits + 1];
+	uint16_t symbols[288];
+	// symbol << 4 | length of the code starting with every fastBits bits of
+	// input, 0 where the code is longer
+	uint16_t fast[1 << fastBits];
+
+	/**
+	 * Builds the code from the code lengths of its symbols
+	 * @param lengths code length of every symbol, 0 for unused symbols
+	 * @param count   number of symbols, at most 288
+	 */
+	void build(unsigned char const *lengths, unsigned int count) {
+		std::fill(counts, counts + maxBits + 1, uint16_t(0));
+		for (unsigned int i = 0; i < count; i++) {
+			counts[lengths[i]]++;
+		}
+		counts[0] = 0;
+
+		// Incomplete codes are allowed, as a code with a single distance needs one
+		int left = 1;
+		for (unsigned int length = 1; length <= maxBits; length++) {
+			left = 2 * left - counts[length];
+			if (left < 0) {
+				fail("invalid Huffman code");
+			}
+		}
+
+		uint16_t offsets[maxBits + 2];
+		uint16_t nextCode[maxBits + 1];
+		offsets[1] = 0;
+		nextCode[0] = 0;
+		for (unsigned int length = 1; length <= maxBits; length++) {
+			offsets[length + 1] = uint16_t(offsets[length] + counts[length]);
+			nextCode[length] = uint16_t((nextCode[length - 1] + counts[length - 1]) << 1);
+		}
+
+		std::fill(fast, fast + (1 << fastBits), uint16_t(0));
+		for (unsigned int symbol = 0; symbol < count; symbol++) {
+			unsigned int length = lengths[symbol];
+			if (length == 0) {
+				continue;
+			}
+			symbols[offsets[length]++] = uint16_t(symbol);
+			unsigned int code = nextCode[length]++;
+			if (length > fastBits) {
+				continue;
+			}
+			// Codes are stored starting with their highest bit
+			unsigned int reversed = 0;
+			for (unsigned int bit = 0; bit < length; bit++) {
+				reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+			}
+			for (unsigned int i = reversed; i < (1u << fastBits); i += 1u << length) {
+				fast[i] = uint16_t(symbol << 4 | length);
+			}
+		}
+	}
+} HuffmanCode;
+
+struct InflateStream::Decoder {
+	enum class Stage {
+		BlockHeader,
+		Stored,
+		Compressed,
+		Finished
+	};
+
+	unsigned char const *input;
+	size_t inputSize;
+	// Next byte of the input which is not in the bit buffer yet
+	size_t position;
+	// Bits read ahead, the next bit is the lowest one
+	uint64_t bits;
+	unsigned int bitCount;
+
+	bool gzip;
+	uint32_t checksum;
+	bool verified;
+
+	Stage stage;
+	bool lastBlock;
+	size_t storedRemaining;
+	HuffmanCode literals;
+	HuffmanCode distances;
+	HuffmanCode codeLengths;
+
+	// Back reference which did not fit in the output of the previous read
+	size_t copyLength;
+	size_t copyDistance;
+
+	// The last windowSize bytes of output, for back references
+	std::vector<unsigned char> window;
+	uint64_t outputSize;
+
+	void refill() {
+		while (bitCount <= 56 && position < inputSize) {
+			bits |= uint64_t(input[position++]) << bitCount;
+			bitCount += 8;
+		}
+	}
+
+	unsigned int getBits(unsigned int count) {
+		if (bitCount < count) {
+			refill();
+			if (bitCount < count) {
+				fail("the stream is truncated");
+			}
+		}
+		unsigned int value = unsigned(bits & ((uint64_t(1) << count) - 1));
+		bits >>= count;
+		bitCount -= count;
+		return value;
+	}
+
+	/**
+	 * @return next symbol of the given code
+	 */
+	unsigned int decode(HuffmanCode const &code) {
+		if (bitCount < HuffmanCode::maxBits) {
+			refill();
+		}
+		unsigned int entry = code.fast[bits & ((1u << HuffmanCode::fastBits) - 1)];
+		unsigned int length = entry & 15;
+		if (entry != 0 && length <= bitCount) {
+			bits >>= length;
+			bitCount -= length;
+			return entry >> 4;
+		}
+
+		// Long codes, compared with the first code of every length
+		int value = 0;
+		int first = 0;
+		int index = 0;
+		for (length = 1; length <= HuffmanCode::maxBits; length++) {
+			value |= int(getBits(1));
+			int count = code.counts[length];
+			if (value - count < first) {
+				return code.symbols[index + (value - first)];
+			}
+			index += count;
+			first = (first + count) << 1;
+			value <<= 1;
+		}
+		fail("invalid Huffman code");
+	}
+
+	void readBlockHeader() {
+		lastBlock = getBits(1) != 0;
+		unsigned int type = getBits(2);
+		if (type == 0) {
+			getBits(bitCount % 8);
+			unsigned int length = getBits(16);
+			unsigned int complement = getBits(16);
+			if (length != (~complement & 0xFFFF)) {
+				fail("invalid stored block");
+			}
+			storedRemaining = length;
+			stage = Stage::Stored;
+		} else if (type == 1) {
+			unsigned char lengths[288 + 30];
+			std::fill(lengths, lengths + 144, 8);
+			std::fill(lengths + 144, lengths + 256, 9);
+			std::fill(lengths + 256, lengths + 280, 7);
+			std::fill(lengths + 280, lengths + 288, 8);
+			std::fill(lengths + 288, lengths + 288 + 30, 5);
+			literals.build(lengths, 288);
+			distances.build(lengths + 288, 30);
+			stage = Stage::Compressed;
+		} else if (type == 2) {
+			readDynamicCodes();
+			stage = Stage::Compressed;
+		} else {
+			fail("invalid block type");
+		}
+	}
+
+	void readDynamicCodes() {
+		unsigned int literalCount = getBits(5) + 257;
+		unsigned int distanceCount = getBits(5) + 1;
+		unsigned int codeLengthCount = getBits(4) + 4;
+		if (literalCount > 286 || distanceCount > 30) {
+			fail("invalid dynamic block");
+		}
+
+		unsigned char lengths[286 + 30] = {};
+		for (unsigned int i = 0; i < codeLengthCount; i++) {
+			lengths[codeLengthOrder[i]] = (unsigned char) getBits(3);
+		}
+		codeLengths.build(lengths, 19);
+
+		unsigned int total = literalCount + distanceCount;
+		unsigned int i = 0;
+		while (i < total) {
+			unsigned int symbol = decode(codeLengths);
+			if (symbol < 16) {
+				lengths[i++] = (unsigned char) symbol;
+				continue;
+			}
+			unsigned char value = 0;
+			unsigned int repeat;
+			if (symbol == 16) {
+				if (i == 0) {
+					fail("invalid dynamic block");
+				}
+				value = lengths[i - 1];
+				repeat = 3 + getBits(2);
+			} else if (symbol == 17) {
+				repeat = 3 + getBits(3);
+			} else {
+				repeat = 11 + getBits(7);
+			}
+			if (i + repeat > total) {
+				fail("invalid dynamic block");
+			}
+			std::fill(lengths + i, lengths + i + repeat, value);
+			i += repeat;
+		}
+		if (lengths[256] == 0) {
+			fail("invalid dynamic block");
+		}
+		literals.build(lengths, literalCount);
+		distances.build(lengths + literalCount, distanceCount);
+	}
+
+	/**
+	 * Decompresses until the output is full or the stream ends
+	 * @return number of bytes written
+	 */
+	size_t inflate(unsigned char *output, size_t capacity) {
+		size_t written = 0;
+		auto put = [&](unsigned char byte) {
+			output[written++] = byte;
+			window[size_t(outputSize++) & (windowSize - 1)] = byte;
+		};
+
+		while (written < capacity) {
+			if (copyLength > 0) {
+				size_t count = std::min(copyLength, capacity - written);
+				for (size_t i = 0; i < count; i++) {
+					put(window[size_t(outputSize - copyDistance) & (windowSize - 1)]);
+				}
+				copyLength -= count;
+			} else if (stage == Stage::Compressed) {
+				unsigned int symbol = decode(literals);
+				if (symbol < 256) {
+					put((unsigned char) symbol);
+				} else if (symbol == 256) {
+					stage = lastBlock ? Stage::Finished : Stage::BlockHeader;
+				} else {
+					symbol -= 257;
+					if (symbol >= 29) {
+						fail("invalid length code");
+					}
+					copyLength = lengthBase[symbol] + getBits(lengthExtra[symbol]);
+					unsigned int distance = decode(distances);
+					if (distance >= 30) {
+						fail("invalid distance code");
+					}
+					copyDistance = distanceBase[distance] + getBits(distanceExtra[distance]);
+					if (copyDistance > outputSize) {
+						fail("invalid distance");
+					}
+				}
+			} else if (stage == Stage::Stored) {
+				if (storedRemaining == 0) {
+					stage = lastBlock ? Stage::Finished : Stage::BlockHeader;
+				} else {
+					put((unsigned char) getBits(8));
+					storedRemaining--;
+				}
+			} else if (stage == Stage::BlockHeader) {
+				readBlockHeader();
+			} else {
+				break;
+			}
+		}
+		return written;
+	}
+
+	/**
+	 * Compares the trailer of the stream with the checksum of the output
+	 */
+	void verify() {
+		getBits(bitCount % 8);
+		uint32_t expected = 0;
+		if (gzip) {
+			for (unsigned int i = 0; i < 4; i++) {
+				expected |= uint32_t(getBits(8)) << (8 * i);
+			}
+			uint32_t sizeModulo = 0;
+			for (unsigned int i = 0; i < 4; i++) {
+				sizeModulo |= uint32_t(getBits(8)) << (8 * i);
+			}
+			if (expected != checksum || sizeModulo != uint32_t(outputSize)) {
+				fail("the gzip checksum does not match, the file is corrupt");
+			}
+		} else {
+			for (unsigned int i = 0; i < 4; i++) {
+				expected = expected << 8 | getBits(8);
+			}
+			if (expected != checksum) {
+				fail("the zlib checksum does not match, the file is corrupt");
+			}
+		}
+		verified = true;
+	}
+};
+
+InflateStream::InflateStream(char const *begin, char const *end) : decoder(new Decoder())
+{
+	unsigned char const *data = reinterpret_cast<unsigned char const *>(begin);
+	size_t size = size_t(end - begin);
+	Decoder &d = *decoder;
+
+	size_t position;
+	if (isZlib(data, size)) {
+		if (data[1] & zlibDictionary) {
+			fail("zlib streams with a preset dictionary are not supported");
+		}
+		position = 2;
+		d.gzip = false;
+		d.checksum = 1;
+	} else if (isGzip(data, size)) {
+		// Header: magic, method, flags, modification time, extra flags and
+		// operating system, followed by the optional fields the flags announce
+		size_t const headerSize = 10;
+		if (size < headerSize) {
+			fail("the gzip header is truncated");
+		}
+		unsigned char flags = data[3];
+		position = headerSize;
+		auto skip = [&](size_t count) {
+			if (count > size - position) {
+				fail("the gzip header is truncated");
+			}
+			position += count;
+		};
+		auto skipString = [&]() {
+			while (position < size && data[position] != 0) {
+				position++;
+			}
+			skip(1);
+		};
+		if (flags & gzipExtra) {
+			skip(2);
+			skip(size_t(data[position - 2]) | size_t(data[position - 1]) << 8);
+		}
+		if (flags & gzipName) {
+			skipString();
+		}
+		if (flags & gzipComment) {
+			skipString();
+		}
+		if (flags & gzipHeaderCRC) {
+			skip(2);
+		}
+		d.gzip = true;
+		d.checksum = 0;
+	} else {
+		fail("not a gzip or zlib stream");
+	}
+
+	d.input = data;
+	d.inputSize = size;
+	d.position = position;
+	d.bits = 0;
+	d.bitCount = 0;
+	d.verified = false;
+	d.stage = Decoder::Stage::BlockHeader;
+	d.lastBlock = false;
+	d.storedRemaining = 0;
+	d.copyLength = 0;
+	d.copyDistance = 0;
+	d.window.resize(windowSize);
+	d.outputSize = 0;
+}
+
+InflateStream::~InflateStream()
+{
+}
+
+size_t InflateStream::read(char *output, size_t capacity)
+{
+	Decoder &d = *decoder;
+	unsigned char *bytes = reinterpret_cast<unsigned char *>(output);
+	size_t written = d.inflate(bytes, capacity);
+	d.checksum = d.gzip ? updateCRC32(d.checksum, bytes, written) : updateAdler32(d.checksum, bytes, written);
+	if (d.stage == Decoder::Stage::Finished && !d.verified) {
+		d.verify();
+	}
+	return written;
+}
+
+bool InflateStream::finished() const
+{
+	return decoder->verified;
+}
+
+bool isCompressed(char const *begin, char const *end)
+{
+	unsigned char const *data = reinterpret_cast<unsigned char const *>(begin);
+	size_t size = size_t(end - begin);
+	return isGzip(data, size) || isZlib(data, size);
+}
+
+void decompress(char const *begin, char const *end, DecompressedData &output)
+{
+	InflateStream stream(begin, end);
+
+	// Text usually compresses 3 to 8 times, the buffer doubles when it is full
+	size_t capacity = std::max(size_t(end - begin) * 4, windowSize);
+	output.data.reset(static_cast<unsigned char *>(std::malloc(capacity)));
+	output.size = 0;
+	if (!output.data) {
+		throw std::bad_alloc();
+	}
+	while (!stream.finished()) {
+		if (output.size == capacity) {
+			capacity *= 2;
+			unsigned char *grown = static_cast<unsigned char *>(std::realloc(output.data.get(), capacity));
+			if (grown == nullptr) {
+				throw std::bad_alloc();
+			}
+			output.data.release();
+			output.data.reset(grown);
+		}
+		output.size += stream.read(reinterpret_cast<char *>(output.data.get()) + output.size, capacity - output.size);
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+
+// Gzip (RFC 1952) and zlib (RFC 1950) compressed files. Compressed OBJ files
+// are usually 3 to 8 times smaller, which pays off when reading the file
+// takes longer than inflating it.
+//
+// The deflate stream (RFC 1951) is decoded piece by piece (see InflateStream):
+// the decoder only keeps the last 32 KB of its output, which later back
+// references may copy from, so a file can be parsed while it is inflated
+// without ever holding all of its text. Errors throw std::runtime_error with
+// a message starting with "Decompressing failed:".
+
+/**
+ * Decompressed contents of a file
+ */
+typedef struct DecompressedData {
+	// Allocated with malloc, grown with realloc
+	std::unique_ptr<unsigned char, void (*)(void *)> data;
+	size_t size;
+
+	DecompressedData() : data(nullptr, std::free) {
+		size = 0;
+	}
+
+	char const *begin() const {
+		return reinterpret_cast<char const *>(data.get());
+	}
+
+	char const *end() const {
+		return begin() + size;
+	}
+} DecompressedData;
+
+/**
+ * Incremental decoder of a gzip or zlib stream. Every call to read continues
+ * where the previous one stopped. Of a gzip file with several members, only
+ * the first one is decompressed. The checksum in the trailer of the stream is
+ * verified once the end of the stream is reached, so data returned before
+ * that is not known to be intact yet.
+ */
+typedef struct InflateStream {
+	/**
+	 * Reads the header of a gzip or zlib stream
+	 * @param begin start of the compressed stream, which must stay valid
+	 *              while it is decompressed
+	 * @param end   end of the compressed stream
+	 * @throws std::runtime_error if the stream is not gzip or zlib, or its header is truncated
+	 */
+	InflateStream(char const *begin, char const *end);
+	~InflateStream();
+
+	/**
+	 * Decompresses the next part of the stream
+	 * @param  output   returned decompressed data
+	 * @param  capacity size of the output buffer
+	 * @return          number of bytes written, less than capacity only at the end of the stream
+	 * @throws std::runtime_error if the stream is not valid, is truncated, or its checksum does not match
+	 */
+	size_t read(char *output, size_t capacity);
+
+	/**
+	 * @return whether the whole stream was decompressed and verified
+	 */
+	bool finished() const;
+
+private:
+	InflateStream(InflateStream const &);
+	InflateStream &operator=(InflateStream const &);
+
+	struct Decoder;
+	std::unique_ptr<Decoder> decoder;
+} InflateStream;
+
+/**
+ * @param  begin start of the contents of a file
+ * @param  end   end of the contents of a file
+ * @return       whether the contents start with a gzip or zlib header
+ */
+bool isCompressed(char const *begin, char const *end);
+
+/**
+ * Decompresses a whole gzip or zlib stream into one buffer (see InflateStream)
+ * @param begin  start of the compressed stream
+ * @param end    end of the compressed stream
+ * @param output returned decompressed data
+ * @throws std::runtime_error if the stream is not valid, is truncated, or its checksum does not match
+ */
+void decompress(char const *begin, char const *end, DecompressedData &output);
@@ -17,4 +17,50 @@ float length(float2 vec) {
 
 float length(float3 vec) {
 	return sqrt(vec.x * vec.x + vec.y * vec.y + vec.z * vec.z);
-}
\ No newline at end of file
+}
+
+float3 normalize(float3 in) {
+	float inverseLength = 1.0f / length(in);
+	return make_float3(in.x * inverseLength, in.y * inverseLength, in.z * inverseLength);
+}
+
+mat4x4 inverse(mat4x4 const &m) {
+	// Inverse through the adjugate matrix, expanding the 2x2 sub-determinants
+	// of the top and bottom two rows
+	float s0 = m.m00 * m.m11 - m.m10 * m.m01;
+	float s1 = m.m00 * m.m12 - m.m10 * m.m02;
+	float s2 = m.m00 * m.m13 - m.m10 * m.m03;
+	float s3 = m.m01 * m.m12 - m.m11 * m.m02;
+	float s4 = m.m01 * m.m13 - m.m11 * m.m03;
+	float s5 = m.m02 * m.m13 - m.m12 * m.m03;
+
+	float c5 = m.m22 * m.m33 - m.m32 * m.m23;
+	float c4 = m.m21 * m.m33 - m.m31 * m.m23;
+	float c3 = m.m21 * m.m32 - m.m31 * m.m22;
+	float c2 = m.m20 * m.m33 - m.m30 * m.m23;
+	float c1 = m.m20 * m.m32 - m.m30 * m.m22;
+	float c0 = m.m20 * m.m31 - m.m30 * m.m21;
+
+	float inverseDeterminant = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+	return mat4x4(
+		( m.m11 * c5 - m.m12 * c4 + m.m13 * c3) * inverseDeterminant,
+		(-m.m01 * c5 + m.m02 * c4 - m.m03 * c3) * inverseDeterminant,
+		( m.m31 * s5 - m.m32 * s4 + m.m33 * s3) * inverseDeterminant,
+		(-m.m21 * s5 + m.m22 * s4 - m.m23 * s3) * inverseDeterminant,
+
+		(-m.m10 * c5 + m.m12 * c2 - m.m13 * c1) * inverseDeterminant,
+		( m.m00 * c5 - m.m02 * c2 + m.m03 * c1) * inverseDeterminant,
+		(-m.m30 * s5 + m.m32 * s2 - m.m33 * s1) * inverseDeterminant,
+		( m.m20 * s5 - m.m22 * s2 + m.m23 * s1) * inverseDeterminant,
+
+		( m.m10 * c4 - m.m11 * c2 + m.m13 * c0) * inverseDeterminant,
+		(-m.m00 * c4 + m.m01 * c2 - m.m03 * c0) * inverseDeterminant,
+		( m.m30 * s4 - m.m31 * s2 + m.m33 * s0) * inverseDeterminant,
+		(-m.m20 * s4 + m.m21 * s2 - m.m23 * s0) * inverseDeterminant,
+
+		(-m.m10 * c3 + m.m11 * c1 - m.m12 * c0) * inverseDeterminant,
+		( m.m00 * c3 - m.m01 * c1 + m.m02 * c0) * inverseDeterminant,
+		(-m.m30 * s3 + m.m31 * s1 - m.m32 * s0) * inverseDeterminant,
+		( m.m20 * s3 - m.m21 * s1 + m.m22 * s0) * inverseDeterminant);
+}
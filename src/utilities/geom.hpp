@@ -152,14 +152,6 @@ typedef struct float4 {
 		return *this != tmp;
 	}
 
-	float4& operator= (float4 other) {
-		x = other.x;
-		y = other.y;
-		z = other.z;
-		w = other.w;
-		return *this;
-	}
-
 	float3 toFloat3() {
 		float3 vec;
 		vec.x = x;
@@ -179,41 +171,40 @@ typedef struct mat4x4 {
 
 
 
-	mat4x4(
+	constexpr mat4x4(
 	float v00, float v01, float v02, float v03,
 	float v10, float v11, float v12, float v13,
 	float v20, float v21, float v22, float v23,
-	float v30, float v31, float v32, float v33) {
-		m00 = v00; m01 = v01; m02 = v02; m03 = v03;
-		m10 = v10; m11 = v11; m12 = v12; m13 = v13;
-		m20 = v20; m21 = v21; m22 = v22; m23 = v23;
-		m30 = v30; m31 = v31; m32 = v32; m33 = v33;
+	float v30, float v31, float v32, float v33) :
+		m00(v00), m01(v01), m02(v02), m03(v03),
+		m10(v10), m11(v11), m12(v12), m13(v13),
+		m20(v20), m21(v21), m22(v22), m23(v23),
+		m30(v30), m31(v31), m32(v32), m33(v33) {
 	};
 
 	mat4x4() {
 
 	}
 
-	mat4x4 operator* (mat4x4 mat2) {
-		mat4x4 mat1 = *this;
-
+	// constexpr, so fixed matrices can be composed at compile time
+	constexpr mat4x4 operator* (mat4x4 const &mat2) const {
 		return mat4x4(
-			mat2.m00 * mat1.m00 + mat2.m10 * mat1.m01 + mat2.m20 * mat1.m02 + mat2.m30 * mat1.m03,
-			mat2.m01 * mat1.m00 + mat2.m11 * mat1.m01 + mat2.m21 * mat1.m02 + mat2.m31 * mat1.m03,
-			mat2.m02 * mat1.m00 + mat2.m12 * mat1.m01 + mat2.m22 * mat1.m02 + mat2.m32 * mat1.m03,
-			mat2.m03 * mat1.m00 + mat2.m13 * mat1.m01 + mat2.m23 * mat1.m02 + mat2.m33 * mat1.m03,
-			mat2.m00 * mat1.m10 + mat2.m10 * mat1.m11 + mat2.m20 * mat1.m12 + mat2.m30 * mat1.m13,
-			mat2.m01 * mat1.m10 + mat2.m11 * mat1.m11 + mat2.m21 * mat1.m12 + mat2.m31 * mat1.m13,
-			mat2.m02 * mat1.m10 + mat2.m12 * mat1.m11 + mat2.m22 * mat1.m12 + mat2.m32 * mat1.m13,
-			mat2.m03 * mat1.m10 + mat2.m13 * mat1.m11 + mat2.m23 * mat1.m12 + mat2.m33 * mat1.m13,
-			mat2.m00 * mat1.m20 + mat2.m10 * mat1.m21 + mat2.m20 * mat1.m22 + mat2.m30 * mat1.m23,
-			mat2.m01 * mat1.m20 + mat2.m11 * mat1.m21 + mat2.m21 * mat1.m22 + mat2.m31 * mat1.m23,
-			mat2.m02 * mat1.m20 + mat2.m12 * mat1.m21 + mat2.m22 * mat1.m22 + mat2.m32 * mat1.m23,
-			mat2.m03 * mat1.m20 + mat2.m13 * mat1.m21 + mat2.m23 * mat1.m22 + mat2.m33 * mat1.m23,
-			mat2.m00 * mat1.m30 + mat2.m10 * mat1.m31 + mat2.m20 * mat1.m32 + mat2.m30 * mat1.m33,
-			mat2.m01 * mat1.m30 + mat2.m11 * mat1.m31 + mat2.m21 * mat1.m32 + mat2.m31 * mat1.m33,
-			mat2.m02 * mat1.m30 + mat2.m12 * mat1.m31 + mat2.m22 * mat1.m32 + mat2.m32 * mat1.m33,
-			mat2.m03 * mat1.m30 + mat2.m13 * mat1.m31 + mat2.m23 * mat1.m32 + mat2.m33 * mat1.m33);
+			mat2.m00 * m00 + mat2.m10 * m01 + mat2.m20 * m02 + mat2.m30 * m03,
+			mat2.m01 * m00 + mat2.m11 * m01 + mat2.m21 * m02 + mat2.m31 * m03,
+			mat2.m02 * m00 + mat2.m12 * m01 + mat2.m22 * m02 + mat2.m32 * m03,
+			mat2.m03 * m00 + mat2.m13 * m01 + mat2.m23 * m02 + mat2.m33 * m03,
+			mat2.m00 * m10 + mat2.m10 * m11 + mat2.m20 * m12 + mat2.m30 * m13,
+			mat2.m01 * m10 + mat2.m11 * m11 + mat2.m21 * m12 + mat2.m31 * m13,
+			mat2.m02 * m10 + mat2.m12 * m11 + mat2.m22 * m12 + mat2.m32 * m13,
+			mat2.m03 * m10 + mat2.m13 * m11 + mat2.m23 * m12 + mat2.m33 * m13,
+			mat2.m00 * m20 + mat2.m10 * m21 + mat2.m20 * m22 + mat2.m30 * m23,
+			mat2.m01 * m20 + mat2.m11 * m21 + mat2.m21 * m22 + mat2.m31 * m23,
+			mat2.m02 * m20 + mat2.m12 * m21 + mat2.m22 * m22 + mat2.m32 * m23,
+			mat2.m03 * m20 + mat2.m13 * m21 + mat2.m23 * m22 + mat2.m33 * m23,
+			mat2.m00 * m30 + mat2.m10 * m31 + mat2.m20 * m32 + mat2.m30 * m33,
+			mat2.m01 * m30 + mat2.m11 * m31 + mat2.m21 * m32 + mat2.m31 * m33,
+			mat2.m02 * m30 + mat2.m12 * m31 + mat2.m22 * m32 + mat2.m32 * m33,
+			mat2.m03 * m30 + mat2.m13 * m31 + mat2.m23 * m32 + mat2.m33 * m33);
 	}
 
 	float4 operator* (float4 other) {
@@ -228,6 +219,118 @@ typedef struct mat4x4 {
 	}
 } mat4x4;
 
+/**
+ * Inverts a matrix
+ * @param  m invertible matrix
+ * @return   inverse of m
+ */
+mat4x4 inverse(mat4x4 const &m);
+
+// The camera used by the renderer.
+// This projection matrix assumes a 16:9 aspect ratio, and an field of view (FOV) of 90 degrees.
+constexpr mat4x4 projectionMatrix(
+	0.347270,   0, 			0, 		0,
+	0,	  		0.617370, 	0,		0,
+	0,	  		0,			-1, 	-0.2f,
+	0,	  		0,			-1,		0);
+
+constexpr mat4x4 viewMatrix(
+	0.5, 	0, 		0, 		5,
+	0, 		-0.5, 	0, 		30,
+	0, 		0, 		0.5, 	-55,
+	0, 		0, 		0, 		1);
+
+constexpr mat4x4 identityMatrix(
+	1, 0, 0, 0,
+	0, 1, 0, 0,
+	0, 0, 1, 0,
+	0, 0, 0, 1);
+
+// Structure of a transformation matrix, from most to least specialised.
+// Transforming a point with a specialised matrix skips the multiplications
+// with the known zeros and ones, and the perspective division where w stays 1.
+enum class MatrixClass {
+	// No transformation at all
+	Identity,
+	// Last row is (0, 0, 0, 1): w stays 1
+	Affine,
+	// Last row is (0, 0, m32, m33): w only depends on z
+	Perspective,
+	// Anything else
+	General
+};
+
+constexpr bool isAffine(mat4x4 const &m) {
+	return m.m30 == 0 && m.m31 == 0 && m.m32 == 0 && m.m33 == 1;
+}
+
+constexpr bool isIdentity(mat4x4 const &m) {
+	return isAffine(m) &&
+		m.m00 == 1 && m.m01 == 0 && m.m02 == 0 && m.m03 == 0 &&
+		m.m10 == 0 && m.m11 == 1 && m.m12 == 0 && m.m13 == 0 &&
+		m.m20 == 0 && m.m21 == 0 && m.m22 == 1 && m.m23 == 0;
+}
+
+/**
+ * Determines the most specialised class a matrix belongs to
+ * @param  m matrix
+ * @return   class of the matrix
+ */
+constexpr MatrixClass classifyMatrix(mat4x4 const &m) {
+	return isIdentity(m) ? MatrixClass::Identity :
+		isAffine(m) ? MatrixClass::Affine :
+		(m.m30 == 0 && m.m31 == 0) ? MatrixClass::Perspective :
+		MatrixClass::General;
+}
+
+/**
+ * Transforms a point (w = 1) with a matrix of a known class. The result is
+ * the same as m * point, except that terms which are always zero are left
+ * out of the sums. Leaving them out does not change the rounding of the result.
+ * @param  m     matrix of class type
+ * @param  point point to transform, w is assumed to be 1
+ * @return       transformed point, not divided by w
+ */
+template <MatrixClass type>
+inline float4 transformPoint(mat4x4 const &m, float4 const point);
+
+template <>
+inline float4 transformPoint<MatrixClass::Identity>(mat4x4 const &, float4 const point) {
+	float4 transformed = point;
+	transformed.w = 1;
+	return transformed;
+}
+
+template <>
+inline float4 transformPoint<MatrixClass::Affine>(mat4x4 const &m, float4 const point) {
+	float4 transformed;
+	transformed.x = m.m00 * point.x + m.m01 * point.y + m.m02 * point.z + m.m03;
+	transformed.y = m.m10 * point.x + m.m11 * point.y + m.m12 * point.z + m.m13;
+	transformed.z = m.m20 * point.x + m.m21 * point.y + m.m22 * point.z + m.m23;
+	transformed.w = 1;
+	return transformed;
+}
+
+template <>
+inline float4 transformPoint<MatrixClass::Perspective>(mat4x4 const &m, float4 const point) {
+	float4 transformed;
+	transformed.x = m.m00 * point.x + m.m01 * point.y + m.m02 * point.z + m.m03;
+	transformed.y = m.m10 * point.x + m.m11 * point.y + m.m12 * point.z + m.m13;
+	transformed.z = m.m20 * point.x + m.m21 * point.y + m.m22 * point.z + m.m23;
+	transformed.w = m.m32 * point.z + m.m33;
+	return transformed;
+}
+
+template <>
+inline float4 transformPoint<MatrixClass::General>(mat4x4 const &m, float4 const point) {
+	float4 transformed;
+	transformed.x = m.m00 * point.x + m.m01 * point.y + m.m02 * point.z + m.m03;
+	transformed.y = m.m10 * point.x + m.m11 * point.y + m.m12 * point.z + m.m13;
+	transformed.z = m.m20 * point.x + m.m21 * point.y + m.m22 * point.z + m.m23;
+	transformed.w = m.m30 * point.x + m.m31 * point.y + m.m32 * point.z + m.m33;
+	return transformed;
+}
+
 
 
 float length(float2 vec);
@@ -250,6 +353,41 @@ inline float3 make_float3(float x, float y, float z) {
 
 float2 to_float2(float3 vec);
 
+/**
+ * Octahedral normal encoding: projects a direction onto the octahedron
+ * |x| + |y| + |z| = 1, and unfolds the lower half over the upper one, mapping
+ * every direction onto the square [-1, 1] x [-1, 1]. The direction does not
+ * need to be normalised.
+ * @param  normal direction, not all zero
+ * @return        encoded direction in [-1, 1] x [-1, 1]
+ */
+inline float2 octahedralEncode(float3 const normal) {
+	float scale = 1.0f / (std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z));
+	float2 encoded = make_float2(normal.x * scale, normal.y * scale);
+	if (normal.z < 0) {
+		float x = encoded.x;
+		encoded.x = (1.0f - std::fabs(encoded.y)) * (x >= 0 ? 1.0f : -1.0f);
+		encoded.y = (1.0f - std::fabs(x)) * (encoded.y >= 0 ? 1.0f : -1.0f);
+	}
+	return encoded;
+}
+
+/**
+ * Inverse of octahedralEncode
+ * @param  encoded encoded direction in [-1, 1] x [-1, 1]
+ * @return         normalised direction
+ */
+inline float3 octahedralDecode(float2 const encoded) {
+	float3 normal(encoded.x, encoded.y, 1.0f - std::fabs(encoded.x) - std::fabs(encoded.y));
+	if (normal.z < 0) {
+		float x = normal.x;
+		normal.x = (1.0f - std::fabs(normal.y)) * (x >= 0 ? 1.0f : -1.0f);
+		normal.y = (1.0f - std::fabs(x)) * (normal.y >= 0 ? 1.0f : -1.0f);
+	}
+	float inverseLength = 1.0f / std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+	return make_float3(normal.x * inverseLength, normal.y * inverseLength, normal.z * inverseLength);
+}
+
 float2 normalize(float2 in);
 float3 normalize(float3 in);
 
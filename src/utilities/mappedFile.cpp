@@ -0,0 +1,62 @@
+#include "mappedFile.hpp"
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP
+#endif
+
+MappedFile::MappedFile(std::string const &path, bool writable)
+{
+	contents = nullptr;
+	length = 0;
+	mapped = false;
+
+#ifdef MAPPED_FILE_MMAP
+	int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		throw std::runtime_error("Opening '" + path + "' failed.");
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+		int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+		void *address = mmap(nullptr, size_t(status.st_size), protection, MAP_PRIVATE, descriptor, 0);
+		if (address != MAP_FAILED) {
+			if (!writable) {
+				// Text files are read front to back exactly once
+				madvise(address, size_t(status.st_size), MADV_SEQUENTIAL);
+			}
+			contents = static_cast<char const *>(address);
+			length = size_t(status.st_size);
+			mapped = true;
+		}
+	}
+	close(descriptor);
+	if (mapped) {
+		return;
+	}
+#endif
+
+	// Empty files can not be mapped, and not every system supports mapping
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Opening '" + path + "' failed.");
+	}
+	buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	contents = buffer.data();
+	length = buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef MAPPED_FILE_MMAP
+	if (mapped) {
+		munmap(const_cast<char *>(contents), length);
+	}
+#endif
+}
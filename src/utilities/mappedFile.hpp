@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * View of a whole file. On POSIX systems the file is memory mapped,
+ * so its contents are paged in directly from the page cache without being
+ * copied; elsewhere (or if mapping fails) it is read into a buffer.
+ */
+typedef struct MappedFile {
+	/**
+	 * Opens and maps a file
+	 * @param path     path of the file
+	 * @param writable map the file copy-on-write: the contents may be changed
+	 *                 through data(), without changing the file itself
+	 */
+	explicit MappedFile(std::string const &path, bool writable = false);
+	~MappedFile();
+
+	/**
+	 * @return contents of a file opened as writable
+	 */
+	char *data() {
+		return const_cast<char *>(contents);
+	}
+
+	char const *begin() const {
+		return contents;
+	}
+
+	char const *end() const {
+		return contents + length;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+private:
+	MappedFile(MappedFile const &);
+	MappedFile &operator=(MappedFile const &);
+
+	char const *contents;
+	size_t length;
+	bool mapped;
+	std::vector<char> buffer;
+} MappedFile;
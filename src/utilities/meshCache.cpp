@@ -0,0 +1,393 @@
+#include "meshCache.hpp"
+#include "mappedFile.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#include <unistd.h>
+#define MESH_CACHE_SUPPORTED
+#endif
+
+static const char meshCacheMagic[8] = {'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H'};
+static const uint32_t meshCacheVersion = 6;
+static const uint32_t meshCacheByteOrderMark = 0x01020304u;
+static const uint64_t meshCacheAlignment = 64;
+
+typedef struct MeshCacheHeader {
+	char magic[8];
+	uint32_t version;
+	// Rejects caches written on a machine with another byte order or layout
+	uint32_t byteOrderMark;
+	uint32_t vertexSize;
+	uint32_t normalSize;
+	// 2 or 4, for the indices and the indices of the levels of detail
+	uint32_t indexSize;
+	uint32_t quantisedVertexSize;
+	// LoadOptions the mesh was loaded with
+	uint32_t options;
+
+	// Version of the OBJ file
+	uint64_t sourceSize;
+	int64_t sourceModificationTime;
+	uint64_t sourceHash;
+
+	uint64_t vertexCount;
+	uint64_t normalCount;
+	uint64_t indexCount;
+	uint64_t vertexOffset;
+	uint64_t normalOffset;
+	uint64_t indexOffset;
+	uint64_t lodCount;
+	uint64_t lodIndexCount;
+	uint64_t lodOffset;
+	uint64_t lodIndexOffset;
+	uint64_t fileSize;
+
+	// A quantised mesh has quantised vertices instead of vertices and normals
+	uint64_t quantisedVertexOffset;
+	uint32_t quantised;
+	float quantisationOffset[3];
+	float quantisationScale[3];
+
+	// Vertex streams, six arrays of streamStride floats each; none if streamStride is 0
+	uint64_t streamOffset;
+	uint64_t streamStride;
+} MeshCacheHeader;
+
+typedef struct MeshCacheLOD {
+	uint64_t indexOffset;
+	uint64_t indexCount;
+	float error;
+	uint32_t padding;
+} MeshCacheLOD;
+
+typedef struct SourceStatus {
+	uint64_t size;
+	// nanoseconds since the epoch
+	int64_t modificationTime;
+} SourceStatus;
+
+std::string meshCachePath(std::string const &src)
+{
+	return src + ".meshcache";
+}
+
+/**
+ * @return the load options which change the loaded mesh, as bits
+ */
+static uint32_t optionBits(LoadOptions const &options)
+{
+	return (options.deindexed ? 1u : 0u) | (uint32_t(options.normals) << 1) | (options.optimise ? 8u : 0u) |
+		   (options.levelsOfDetail ? 16u : 0u) | (options.quantised ? 32u : 0u) |
+		   (options.vertexStreams ? 64u : 0u);
+}
+
+/**
+ * Reads the size and modification time of a file
+ * @param  path   path of the file
+ * @param  status returned status
+ * @return        false if the file can not be found, or the system is not supported
+ */
+static bool readSourceStatus(std::string const &path, SourceStatus &status)
+{
+#ifdef MESH_CACHE_SUPPORTED
+	struct stat fileStatus;
+	if (stat(path.c_str(), &fileStatus) != 0) {
+		return false;
+	}
+	status.size = uint64_t(fileStatus.st_size);
+#if defined(__APPLE__)
+	status.modificationTime = int64_t(fileStatus.st_mtimespec.tv_sec) * 1000000000 + fileStatus.st_mtimespec.tv_nsec;
+#else
+	status.modificationTime = int64_t(fileStatus.st_mtim.tv_sec) * 1000000000 + fileStatus.st_mtim.tv_nsec;
+#endif
+	return true;
+#else
+	(void) path;
+	(void) status;
+	return false;
+#endif
+}
+
+/**
+ * @return suffix which differs between processes (and threads) writing the
+ *         same cache at the same time
+ */
+static std::string temporarySuffix()
+{
+#ifdef MESH_CACHE_SUPPORTED
+	return std::to_string(long(getpid()));
+#else
+	return std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#endif
+}
+
+/**
+ * Hashes the contents of a file, 8 bytes at a time
+ * @param  path path of the file
+ * @return      64-bit hash
+ */
+static uint64_t hashFile(std::string const &path)
+{
+	MappedFile file(path);
+	char const *data = file.begin();
+	size_t size = file.size();
+
+	uint64_t hash = 0x9E3779B97F4A7C15ull ^ uint64_t(size);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 32;
+	}
+	uint64_t tail = 0;
+	if (i < size) {
+		std::memcpy(&tail, data + i, size - i);
+	}
+	hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+/**
+ * @return offset rounded up to the section alignment
+ */
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + meshCacheAlignment - 1) & ~(meshCacheAlignment - 1);
+}
+
+/**
+ * @return whether a section lies within the file and is aligned
+ */
+static bool validSection(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize)
+{
+	return offset % meshCacheAlignment == 0 && offset <= fileSize &&
+		   count <= (fileSize - offset) / elementSize;
+}
+
+/**
+ * @return whether every index of an index buffer references one of the vertices
+ */
+static bool validIndices(char const *data, uint64_t count, bool shortIndices, uint64_t vertexCount)
+{
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t index = shortIndices ? reinterpret_cast<uint16_t const *>(data)[i] : reinterpret_cast<unsigned int const *>(data)[i];
+		if (index >= vertexCount) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool readMeshCache(std::string const &src, LoadOptions const &options, Mesh &mesh)
+{
+	SourceStatus source;
+	if (!readSourceStatus(src, source)) {
+		return false;
+	}
+	std::string cachePath = meshCachePath(src);
+	SourceStatus cache;
+	if (!readSourceStatus(cachePath, cache) || cache.size < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+
+	std::shared_ptr<MappedFile> file;
+	try {
+		// Copy-on-write, so the renderer may treat the arrays like any other mesh
+		file = std::make_shared<MappedFile>(cachePath, true);
+	} catch (std::runtime_error const &) {
+		return false;
+	}
+	if (file->size() < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+
+	MeshCacheHeader header;
+	std::memcpy(&header, file->begin(), sizeof(header));
+	if (std::memcmp(header.magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0 ||
+		header.version != meshCacheVersion ||
+		header.byteOrderMark != meshCacheByteOrderMark ||
+		header.vertexSize != sizeof(float4) ||
+		header.normalSize != sizeof(float3) ||
+		(header.indexSize != sizeof(unsigned int) && header.indexSize != sizeof(uint16_t)) ||
+		header.quantisedVertexSize != sizeof(QuantisedVertex) ||
+		header.options != optionBits(options)) {
+		return false;
+	}
+	uint64_t floatVertexCount = header.quantised ? 0 : header.vertexCount;
+	uint64_t floatNormalCount = header.quantised ? 0 : header.normalCount;
+	uint64_t quantisedVertexCount = header.quantised ? header.vertexCount : 0;
+	if (header.fileSize != file->size() ||
+		!validSection(header.vertexOffset, floatVertexCount, sizeof(float4), header.fileSize) ||
+		!validSection(header.normalOffset, floatNormalCount, sizeof(float3), header.fileSize) ||
+		!validSection(header.quantisedVertexOffset, quantisedVertexCount, sizeof(QuantisedVertex), header.fileSize) ||
+		!validSection(header.indexOffset, header.indexCount, header.indexSize, header.fileSize) ||
+		!validSection(header.lodOffset, header.lodCount, sizeof(MeshCacheLOD), header.fileSize) ||
+		!validSection(header.lodIndexOffset, header.lodIndexCount, header.indexSize, header.fileSize) ||
+		(header.streamStride != 0 && (header.quantised || header.normalCount != header.vertexCount ||
+									  header.streamStride != VertexStreams::stride(size_t(header.vertexCount)))) ||
+		!validSection(header.streamOffset, 6 * header.streamStride, sizeof(float), header.fileSize)) {
+		return false;
+	}
+
+	if (header.sourceSize != source.size) {
+		return false;
+	}
+	if (header.sourceModificationTime != source.modificationTime) {
+		if (header.sourceHash != hashFile(src)) {
+			return false;
+		}
+		// Same contents, only touched: remember the new time for the next load
+		header.sourceModificationTime = source.modificationTime;
+		std::fstream cacheFile(cachePath, std::ios::in | std::ios::out | std::ios::binary);
+		cacheFile.write(reinterpret_cast<char const *>(&header), sizeof(header));
+	}
+
+	char *data = file->data();
+	bool shortIndices = header.indexSize == sizeof(uint16_t);
+	if (!validIndices(data + header.indexOffset, header.indexCount, shortIndices, header.vertexCount) ||
+		!validIndices(data + header.lodIndexOffset, header.lodIndexCount, shortIndices, header.vertexCount)) {
+		return false;
+	}
+	MeshCacheLOD const *lods = reinterpret_cast<MeshCacheLOD const *>(data + header.lodOffset);
+	std::vector<MeshLOD> levels(size_t(header.lodCount));
+	for (uint64_t i = 0; i < header.lodCount; i++) {
+		if (lods[i].indexOffset > header.lodIndexCount || lods[i].indexCount > header.lodIndexCount - lods[i].indexOffset ||
+			lods[i].indexCount % 3 != 0) {
+			return false;
+		}
+		levels[i].indexOffset = size_t(lods[i].indexOffset);
+		levels[i].indexCount = size_t(lods[i].indexCount);
+		levels[i].error = lods[i].error;
+	}
+
+	if (header.quantised) {
+		mesh.quantisedVertices = reinterpret_cast<QuantisedVertex *>(data + header.quantisedVertexOffset);
+		mesh.quantisationOffset = make_float3(header.quantisationOffset[0], header.quantisationOffset[1], header.quantisationOffset[2]);
+		mesh.quantisationScale = make_float3(header.quantisationScale[0], header.quantisationScale[1], header.quantisationScale[2]);
+	} else {
+		mesh.vertices = reinterpret_cast<float4 *>(data + header.vertexOffset);
+		mesh.normals = reinterpret_cast<float3 *>(data + header.normalOffset);
+		if (header.streamStride != 0) {
+			mesh.streams.assign(reinterpret_cast<float *>(data + header.streamOffset), size_t(header.vertexCount));
+		}
+	}
+	if (shortIndices) {
+		mesh.shortIndices = reinterpret_cast<uint16_t *>(data + header.indexOffset);
+		mesh.shortLodIndices = reinterpret_cast<uint16_t *>(data + header.lodIndexOffset);
+	} else {
+		mesh.indices = reinterpret_cast<unsigned int *>(data + header.indexOffset);
+		mesh.lodIndices = reinterpret_cast<unsigned int *>(data + header.lodIndexOffset);
+	}
+	mesh.vertexCount = size_t(header.vertexCount);
+	mesh.normalCount = size_t(header.normalCount);
+	mesh.indexCount = size_t(header.indexCount);
+	mesh.lodIndexCount = size_t(header.lodIndexCount);
+	mesh.lods = levels;
+	mesh.storage = file;
+	return true;
+}
+
+void writeMeshCache(std::string const &src, LoadOptions const &options, Mesh const &mesh)
+{
+	SourceStatus before;
+	SourceStatus after;
+	if (!readSourceStatus(src, before)) {
+		return;
+	}
+
+	MeshCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+	header.version = meshCacheVersion;
+	header.byteOrderMark = meshCacheByteOrderMark;
+	header.vertexSize = sizeof(float4);
+	header.normalSize = sizeof(float3);
+	header.indexSize = mesh.shortIndices != nullptr ? sizeof(uint16_t) : sizeof(unsigned int);
+	header.quantisedVertexSize = sizeof(QuantisedVertex);
+	header.options = optionBits(options);
+	header.sourceSize = before.size;
+	header.sourceModificationTime = before.modificationTime;
+	header.sourceHash = hashFile(src);
+
+	// A file which changed while it was hashed is not cached
+	if (!readSourceStatus(src, after) || after.size != before.size || after.modificationTime != before.modificationTime) {
+		return;
+	}
+
+	header.vertexCount = mesh.vertexCount;
+	header.normalCount = mesh.normalCount;
+	header.indexCount = mesh.indexCount;
+	header.quantised = mesh.quantisedVertices != nullptr ? 1 : 0;
+	uint64_t floatVertexCount = header.quantised ? 0 : header.vertexCount;
+	uint64_t floatNormalCount = header.quantised ? 0 : header.normalCount;
+	uint64_t quantisedVertexCount = header.quantised ? header.vertexCount : 0;
+	header.quantisationOffset[0] = mesh.quantisationOffset.x;
+	header.quantisationOffset[1] = mesh.quantisationOffset.y;
+	header.quantisationOffset[2] = mesh.quantisationOffset.z;
+	header.quantisationScale[0] = mesh.quantisationScale.x;
+	header.quantisationScale[1] = mesh.quantisationScale.y;
+	header.quantisationScale[2] = mesh.quantisationScale.z;
+
+	header.vertexOffset = alignOffset(sizeof(header));
+	header.normalOffset = alignOffset(header.vertexOffset + floatVertexCount * sizeof(float4));
+	header.quantisedVertexOffset = alignOffset(header.normalOffset + floatNormalCount * sizeof(float3));
+	header.streamStride = mesh.streams.x != nullptr ? VertexStreams::stride(mesh.vertexCount) : 0;
+	header.streamOffset = alignOffset(header.quantisedVertexOffset + quantisedVertexCount * sizeof(QuantisedVertex));
+	header.indexOffset = alignOffset(header.streamOffset + 6 * header.streamStride * sizeof(float));
+	header.lodCount = mesh.lods.size();
+	header.lodIndexCount = mesh.lodIndexCount;
+	header.lodOffset = alignOffset(header.indexOffset + header.indexCount * header.indexSize);
+	header.lodIndexOffset = alignOffset(header.lodOffset + header.lodCount * sizeof(MeshCacheLOD));
+	header.fileSize = header.lodIndexOffset + header.lodIndexCount * header.indexSize;
+
+	std::vector<MeshCacheLOD> lods(mesh.lods.size());
+	for (size_t i = 0; i < lods.size(); i++) {
+		std::memset(&lods[i], 0, sizeof(MeshCacheLOD));
+		lods[i].indexOffset = mesh.lods[i].indexOffset;
+		lods[i].indexCount = mesh.lods[i].indexCount;
+		lods[i].error = mesh.lods[i].error;
+	}
+
+	// Written under a temporary name and then renamed, so that other processes
+	// never map a partially written cache
+	std::string cachePath = meshCachePath(src);
+	std::string temporaryPath = cachePath + ".tmp" + temporarySuffix();
+	std::ofstream cacheFile(temporaryPath, std::ios::binary | std::ios::trunc);
+	if (!cacheFile.is_open()) {
+		return;
+	}
+
+	char const padding[meshCacheAlignment] = {};
+	uint64_t position = 0;
+	auto writeSection = [&](uint64_t offset, void const *data, uint64_t size) {
+		cacheFile.write(padding, std::streamsize(offset - position));
+		cacheFile.write(static_cast<char const *>(data), std::streamsize(size));
+		position = offset + size;
+	};
+	writeSection(0, &header, sizeof(header));
+	writeSection(header.vertexOffset, mesh.vertices, floatVertexCount * sizeof(float4));
+	writeSection(header.normalOffset, mesh.normals, floatNormalCount * sizeof(float3));
+	writeSection(header.quantisedVertexOffset, mesh.quantisedVertices, quantisedVertexCount * sizeof(QuantisedVertex));
+	writeSection(header.streamOffset, mesh.streams.x, 6 * header.streamStride * sizeof(float));
+	bool shortIndices = mesh.shortIndices != nullptr;
+	writeSection(header.indexOffset, shortIndices ? static_cast<void const *>(mesh.shortIndices) : mesh.indices,
+				 header.indexCount * header.indexSize);
+	writeSection(header.lodOffset, lods.data(), header.lodCount * sizeof(MeshCacheLOD));
+	writeSection(header.lodIndexOffset, shortIndices ? static_cast<void const *>(mesh.shortLodIndices) : mesh.lodIndices,
+				 header.lodIndexCount * header.indexSize);
+	cacheFile.close();
+
+	if (!cacheFile || std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+		std::remove(temporaryPath.c_str());
+	}
+}
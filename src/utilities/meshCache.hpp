@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include "OBJLoader.hpp"
+
+// Binary mesh cache. Parsing an OBJ file is far slower than reading its
+// triangles back in binary form, so after an OBJ file is parsed, the mesh is
+// written to "<file>.meshcache". Later loads map that file, and the mesh
+// arrays point straight into the mapping.
+//
+// The cache belongs to one version of the OBJ file and one set of load
+// options. It is used when the size and modification time of the OBJ file are
+// unchanged. If only the modification time differs, a hash of the contents
+// decides, so touching a file does not force it to be parsed again.
+//
+// Layout (native byte order, every section 64-byte aligned):
+//     MeshCacheHeader
+//     vertices  (vertexCount float4, none if quantised)
+//     normals   (normalCount float3, none if quantised)
+//     quantised vertices (vertexCount QuantisedVertex, if quantised)
+//     vertex streams (6 arrays of streamStride floats, if loaded with them)
+//     indices   (indexCount unsigned int or uint16_t)
+//     levels of detail (lodCount MeshCacheLOD)
+//     indices of the levels of detail (lodIndexCount, as wide as the indices)
+
+/**
+ * @param  src path of an OBJ file
+ * @return     path of its cache file
+ */
+std::string meshCachePath(std::string const &src);
+
+/**
+ * Maps the cached mesh of an OBJ file, if the cache is valid
+ * @param  src     path of the OBJ file
+ * @param  options load options the mesh must have been loaded with
+ * @param  mesh    returned mesh, its arrays point into the mapped cache
+ * @return         false if there is no valid cache
+ */
+bool readMeshCache(std::string const &src, LoadOptions const &options, Mesh &mesh);
+
+/**
+ * Writes the cache file of an OBJ file. Failing to write the cache (for
+ * instance in a read-only directory) is not an error, the mesh is simply
+ * parsed again next time.
+ * @param src     path of the OBJ file
+ * @param options load options the mesh was loaded with
+ * @param mesh    the loaded mesh
+ */
+void writeMeshCache(std::string const &src, LoadOptions const &options, Mesh const &mesh);
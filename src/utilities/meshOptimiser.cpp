@@ -0,0 +1,506 @@
+#include "meshOptimiser.hpp"
+#include "OBJLoader.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Size of the simulated LRU cache the triangle order is optimised for
+static const unsigned int forsythCacheSize = 32;
+// Size of the FIFO cache used to measure the ACMR and to find clusters
+static const unsigned int fifoCacheSize = 32;
+// A cluster ends once its ACMR is within this factor of the ACMR of the whole run
+static const float clusterThreshold = 1.05f;
+// Width and height of the views used to measure overdraw
+static const unsigned int overdrawViewSize = 256;
+
+static const uint32_t noTriangle = 0xFFFFFFFFu;
+
+/**
+ * FIFO post-transform cache. A vertex is in the cache if fewer than
+ * fifoCacheSize misses happened since its own miss, so a lookup is O(1).
+ */
+typedef struct FIFOCache {
+	std::vector<size_t> missTimes;
+	size_t time;
+
+	explicit FIFOCache(size_t vertexCount) {
+		missTimes.assign(vertexCount, 0);
+		time = fifoCacheSize + 1;
+	}
+
+	/**
+	 * @return whether a vertex missed, which also adds it to the cache
+	 */
+	bool miss(unsigned int const vertex) {
+		if (time - missTimes[vertex] > fifoCacheSize) {
+			missTimes[vertex] = time++;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Forgets every vertex in the cache
+	 */
+	void clear() {
+		time += fifoCacheSize + 1;
+	}
+
+	/**
+	 * @return number of vertices of a triangle which missed
+	 */
+	unsigned int triangleMisses(unsigned int const *triangle) {
+		return unsigned(miss(triangle[0])) + unsigned(miss(triangle[1])) + unsigned(miss(triangle[2]));
+	}
+} FIFOCache;
+
+/**
+ * @return position of a vertex, without w
+ */
+static inline float3 position3(Mesh const &mesh, unsigned int const vertex)
+{
+	float4 const &position = mesh.vertices[vertex];
+	return make_float3(position.x, position.y, position.z);
+}
+
+/**
+ * Measures the overdraw of the mesh in orthographic views along the 6 axes
+ * @param  mesh Mesh object
+ * @return      shaded pixels per covered pixel
+ */
+static float analyseOverdraw(Mesh const &mesh)
+{
+	size_t triangleCount = mesh.indexCount / 3;
+	float minimum[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+	float maximum[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+	for (size_t i = 0; i < mesh.indexCount; i++) {
+		float4 const &position = mesh.vertices[mesh.indices[i]];
+		float const coordinates[3] = {position.x, position.y, position.z};
+		for (unsigned int axis = 0; axis < 3; axis++) {
+			minimum[axis] = std::min(minimum[axis], coordinates[axis]);
+			maximum[axis] = std::max(maximum[axis], coordinates[axis]);
+		}
+	}
+	float extent = std::max(maximum[0] - minimum[0], std::max(maximum[1] - minimum[1], maximum[2] - minimum[2]));
+	if (triangleCount == 0 || !(extent > 0) || !std::isfinite(extent)) {
+		return 0;
+	}
+	float scale = float(overdrawViewSize) / extent;
+
+	std::vector<size_t> shaded(6, 0);
+	std::vector<size_t> covered(6, 0);
+	parallelFor(6, [&](size_t begin, size_t end, unsigned int) {
+		std::vector<float> depthBuffer(overdrawViewSize * overdrawViewSize);
+		for (size_t view = begin; view < end; view++) {
+			// Looking along the axis, from its negative or its positive end
+			unsigned int axis = unsigned(view / 2);
+			float direction = view % 2 == 0 ? 1.0f : -1.0f;
+			unsigned int uAxis = (axis + 1) % 3;
+			unsigned int vAxis = (axis + 2) % 3;
+			std::fill(depthBuffer.begin(), depthBuffer.end(), std::numeric_limits<float>::infinity());
+
+			for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+				float u[3];
+				float v[3];
+				float depth[3];
+				for (unsigned int corner = 0; corner < 3; corner++) {
+					float4 const &position = mesh.vertices[mesh.indices[3 * triangle + corner]];
+					float const coordinates[3] = {position.x, position.y, position.z};
+					u[corner] = (coordinates[uAxis] - minimum[uAxis]) * scale;
+					v[corner] = (coordinates[vAxis] - minimum[vAxis]) * scale;
+					depth[corner] = direction * coordinates[axis];
+				}
+				float area = (u[1] - u[0]) * (v[2] - v[0]) - (v[1] - v[0]) * (u[2] - u[0]);
+				if (!(area != 0) || !std::isfinite(area)) {
+					continue;
+				}
+
+				int minX = std::max(0, int(std::floor(std::min(u[0], std::min(u[1], u[2])))));
+				int minY = std::max(0, int(std::floor(std::min(v[0], std::min(v[1], v[2])))));
+				int maxX = std::min(int(overdrawViewSize) - 1, int(std::ceil(std::max(u[0], std::max(u[1], u[2])))));
+				int maxY = std::min(int(overdrawViewSize) - 1, int(std::ceil(std::max(v[0], std::max(v[1], v[2])))));
+				for (int y = minY; y <= maxY; y++) {
+					for (int x = minX; x <= maxX; x++) {
+						// Barycentric weights of the pixel centre, for either winding
+						float px = float(x) + 0.5f;
+						float py = float(y) + 0.5f;
+						float w0 = ((u[1] - px) * (v[2] - py) - (v[1] - py) * (u[2] - px)) / area;
+						float w1 = ((u[2] - px) * (v[0] - py) - (v[2] - py) * (u[0] - px)) / area;
+						float w2 = 1.0f - w0 - w1;
+						if (w0 < 0 || w1 < 0 || w2 < 0) {
+							continue;
+						}
+						float pixelDepth = w0 * depth[0] + w1 * depth[1] + w2 * depth[2];
+						float &stored = depthBuffer[size_t(y) * overdrawViewSize + size_t(x)];
+						if (pixelDepth < stored) {
+							if (stored == std::numeric_limits<float>::infinity()) {
+								covered[view]++;
+							}
+							stored = pixelDepth;
+							shaded[view]++;
+						}
+					}
+				}
+			}
+		}
+	});
+
+	size_t shadedTotal = 0;
+	size_t coveredTotal = 0;
+	for (unsigned int view = 0; view < 6; view++) {
+		shadedTotal += shaded[view];
+		coveredTotal += covered[view];
+	}
+	return coveredTotal == 0 ? 0.0f : float(shadedTotal) / float(coveredTotal);
+}
+
+MeshStatistics analyseMesh(Mesh const &mesh)
+{
+	MeshStatistics statistics;
+	size_t triangleCount = mesh.indexCount / 3;
+	if (triangleCount == 0) {
+		return statistics;
+	}
+
+	FIFOCache cache(mesh.vertexCount);
+	size_t misses = 0;
+	for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+		misses += cache.triangleMisses(mesh.indices + 3 * triangle);
+	}
+	statistics.averageCacheMissRatio = float(misses) / float(triangleCount);
+	statistics.overdraw = analyseOverdraw(mesh);
+	return statistics;
+}
+
+/**
+ * Forsyth's vertex score: vertices in the cache score higher the more
+ * recently they were used, except that the vertices of the last triangle get
+ * a fixed score, so the next triangle does not simply reuse its edge. Vertices
+ * with few triangles left score higher, so that they are finished off.
+ */
+typedef struct ForsythScores {
+	float cache[forsythCacheSize];
+	float valence[64];
+
+	ForsythScores() {
+		for (unsigned int i = 0; i < forsythCacheSize; i++) {
+			cache[i] = i < 3 ? 0.75f : std::pow(1.0f - float(i - 3) / float(forsythCacheSize - 3), 1.5f);
+		}
+		valence[0] = 0;
+		for (unsigned int i = 1; i < 64; i++) {
+			valence[i] = 2.0f / std::sqrt(float(i));
+		}
+	}
+
+	/**
+	 * @param  cachePosition      position of the vertex in the cache, -1 if it is not in the cache
+	 * @param  remainingTriangles number of triangles of the vertex which are not emitted yet
+	 * @return                    score of the vertex
+	 */
+	float vertex(int const cachePosition, size_t const remainingTriangles) const {
+		if (remainingTriangles == 0) {
+			return -1.0f;
+		}
+		float score = cachePosition >= 0 ? cache[cachePosition] : 0.0f;
+		return score + (remainingTriangles < 64 ? valence[remainingTriangles] : 2.0f / std::sqrt(float(remainingTriangles)));
+	}
+} ForsythScores;
+
+/**
+ * Orders the triangles for the post-transform vertex cache
+ * @param  mesh Mesh object
+ * @return      new index buffer
+ */
+static std::vector<unsigned int> optimiseVertexCache(Mesh const &mesh)
+{
+	size_t triangleCount = mesh.indexCount / 3;
+	size_t vertexCount = mesh.vertexCount;
+	unsigned int const *indices = mesh.indices;
+	ForsythScores scores;
+
+	// Triangles of every vertex. The first remainingTriangles[v] entries of a
+	// vertex are the triangles which are not emitted yet.
+	std::vector<size_t> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		offsets[indices[i] + 1]++;
+	}
+	for (size_t v = 0; v < vertexCount; v++) {
+		offsets[v + 1] += offsets[v];
+	}
+	std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+	std::vector<size_t> remainingTriangles(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		unsigned int vertex = indices[i];
+		vertexTriangles[offsets[vertex] + remainingTriangles[vertex]++] = uint32_t(i / 3);
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		vertexScores[v] = scores.vertex(-1, remainingTriangles[v]);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	uint32_t best = noTriangle;
+	float bestScore = -std::numeric_limits<float>::max();
+	for (size_t t = 0; t < triangleCount; t++) {
+		triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+		if (triangleScores[t] > bestScore) {
+			bestScore = triangleScores[t];
+			best = uint32_t(t);
+		}
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve(triangleCount * 3);
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> newCache;
+	cache.reserve(forsythCacheSize + 3);
+	newCache.reserve(forsythCacheSize + 3);
+	size_t cursor = 0;
+
+	for (size_t i = 0; i < triangleCount; i++) {
+		// No triangle around the cache is left: continue with the next one in the input
+		if (best == noTriangle) {
+			while (emitted[cursor]) {
+				cursor++;
+			}
+			best = uint32_t(cursor);
+		}
+
+		unsigned int const *triangle = indices + 3 * size_t(best);
+		emitted[best] = true;
+		newCache.clear();
+		for (unsigned int corner = 0; corner < 3; corner++) {
+			unsigned int vertex = triangle[corner];
+			output.push_back(vertex);
+			if (std::find(newCache.begin(), newCache.end(), vertex) == newCache.end()) {
+				newCache.push_back(vertex);
+			}
+
+			// Removes the triangle from the remaining triangles of the vertex
+			uint32_t *vertexBegin = vertexTriangles.data() + offsets[vertex];
+			uint32_t *vertexEnd = vertexBegin + remainingTriangles[vertex];
+			uint32_t *found = std::find(vertexBegin, vertexEnd, best);
+			if (found != vertexEnd) {
+				std::swap(*found, *(vertexEnd - 1));
+				remainingTriangles[vertex]--;
+			}
+		}
+		for (unsigned int vertex : cache) {
+			if (std::find(newCache.begin(), newCache.end(), vertex) == newCache.end()) {
+				newCache.push_back(vertex);
+			}
+		}
+
+		// Rescores the vertices in (or just pushed out of) the cache, and their triangles
+		for (size_t position = 0; position < newCache.size(); position++) {
+			unsigned int vertex = newCache[position];
+			cachePositions[vertex] = position < forsythCacheSize ? int(position) : -1;
+			vertexScores[vertex] = scores.vertex(cachePositions[vertex], remainingTriangles[vertex]);
+		}
+		best = noTriangle;
+		bestScore = -std::numeric_limits<float>::max();
+		for (unsigned int vertex : newCache) {
+			for (size_t j = 0; j < remainingTriangles[vertex]; j++) {
+				uint32_t t = vertexTriangles[offsets[vertex] + j];
+				float score = vertexScores[indices[3 * size_t(t)]] + vertexScores[indices[3 * size_t(t) + 1]] +
+							  vertexScores[indices[3 * size_t(t) + 2]];
+				triangleScores[t] = score;
+				if (score > bestScore) {
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+
+		if (newCache.size() > forsythCacheSize) {
+			newCache.resize(forsythCacheSize);
+		}
+		cache.swap(newCache);
+	}
+	return output;
+}
+
+/**
+ * Splits the cache optimised triangles into clusters, and orders the clusters
+ * to reduce overdraw (after Sander et al., "Fast Triangle Reordering for
+ * Vertex Locality and Reduced Overdraw")
+ * @param  mesh    Mesh object, with its vertices
+ * @param  indices cache optimised index buffer
+ * @return         new index buffer
+ */
+static std::vector<unsigned int> optimiseOverdraw(Mesh const &mesh, std::vector<unsigned int> const &indices)
+{
+	size_t triangleCount = indices.size() / 3;
+	FIFOCache cache(mesh.vertexCount);
+
+	// Hard boundaries: triangles with no vertex left in the cache
+	std::vector<size_t> hardBoundaries;
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (cache.triangleMisses(indices.data() + 3 * t) == 3 || t == 0) {
+			hardBoundaries.push_back(t);
+		}
+	}
+	hardBoundaries.push_back(triangleCount);
+
+	// Soft boundaries: a cluster ends once it reuses the cache about as well
+	// as the whole run between two hard boundaries
+	std::vector<size_t> clusters;
+	for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+		size_t begin = hardBoundaries[h];
+		size_t end = hardBoundaries[h + 1];
+		cache.clear();
+		size_t runMisses = 0;
+		for (size_t t = begin; t < end; t++) {
+			runMisses += cache.triangleMisses(indices.data() + 3 * t);
+		}
+		float runRatio = float(runMisses) / float(end - begin);
+
+		cache.clear();
+		size_t clusterBegin = begin;
+		size_t clusterMisses = 0;
+		for (size_t t = begin; t < end; t++) {
+			clusterMisses += cache.triangleMisses(indices.data() + 3 * t);
+			if (float(clusterMisses) / float(t + 1 - clusterBegin) <= clusterThreshold * runRatio) {
+				clusters.push_back(clusterBegin);
+				clusterBegin = t + 1;
+				clusterMisses = 0;
+				cache.clear();
+			}
+		}
+		if (clusterBegin < end) {
+			clusters.push_back(clusterBegin);
+		}
+	}
+	clusters.push_back(triangleCount);
+	size_t clusterCount = clusters.size() - 1;
+
+	// Area weighted centroid and normal of every cluster, and of the whole mesh
+	std::vector<float3> clusterCentroids(clusterCount);
+	std::vector<float3> clusterNormals(clusterCount);
+	float3 meshCentroid = make_float3(0, 0, 0);
+	float meshArea = 0;
+	for (size_t c = 0; c < clusterCount; c++) {
+		float3 centroid = make_float3(0, 0, 0);
+		float3 normal = make_float3(0, 0, 0);
+		float clusterArea = 0;
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			float3 p0 = position3(mesh, indices[3 * t]);
+			float3 p1 = position3(mesh, indices[3 * t + 1]);
+			float3 p2 = position3(mesh, indices[3 * t + 2]);
+			float3 e1 = make_float3(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+			float3 e2 = make_float3(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+			float3 cross = make_float3(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+			float area = std::sqrt(cross.x * cross.x + cross.y * cross.y + cross.z * cross.z);
+			if (!std::isfinite(area)) {
+				continue;
+			}
+			centroid.x += (p0.x + p1.x + p2.x) * area / 3;
+			centroid.y += (p0.y + p1.y + p2.y) * area / 3;
+			centroid.z += (p0.z + p1.z + p2.z) * area / 3;
+			normal.x += cross.x;
+			normal.y += cross.y;
+			normal.z += cross.z;
+			clusterArea += area;
+		}
+		meshCentroid.x += centroid.x;
+		meshCentroid.y += centroid.y;
+		meshCentroid.z += centroid.z;
+		meshArea += clusterArea;
+		if (clusterArea > 0) {
+			centroid = make_float3(centroid.x / clusterArea, centroid.y / clusterArea, centroid.z / clusterArea);
+		}
+		float normalLength = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+		if (normalLength > 0) {
+			normal = make_float3(normal.x / normalLength, normal.y / normalLength, normal.z / normalLength);
+		}
+		clusterCentroids[c] = centroid;
+		clusterNormals[c] = normal;
+	}
+	if (meshArea > 0) {
+		meshCentroid = make_float3(meshCentroid.x / meshArea, meshCentroid.y / meshArea, meshCentroid.z / meshArea);
+	}
+
+	// Clusters facing away from the centre are drawn first: seen from outside
+	// the mesh, they are in front of the others
+	std::vector<float> occlusion(clusterCount);
+	std::vector<size_t> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++) {
+		float3 const &centroid = clusterCentroids[c];
+		float3 const &normal = clusterNormals[c];
+		occlusion[c] = (centroid.x - meshCentroid.x) * normal.x + (centroid.y - meshCentroid.y) * normal.y +
+					   (centroid.z - meshCentroid.z) * normal.z;
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return occlusion[a] > occlusion[b];
+	});
+
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+	for (size_t c : order) {
+		output.insert(output.end(), indices.begin() + long(3 * clusters[c]), indices.begin() + long(3 * clusters[c + 1]));
+	}
+	return output;
+}
+
+/**
+ * Renumbers the vertices in the order the index buffer first uses them
+ * @param mesh Mesh object
+ */
+static void optimiseVertexFetch(Mesh &mesh)
+{
+	std::vector<unsigned int> remap(mesh.vertexCount, noTriangle);
+	unsigned int next = 0;
+	for (size_t i = 0; i < mesh.indexCount; i++) {
+		if (remap[mesh.indices[i]] == noTriangle) {
+			remap[mesh.indices[i]] = next++;
+		}
+	}
+	// Vertices no triangle uses go last
+	for (size_t v = 0; v < mesh.vertexCount; v++) {
+		if (remap[v] == noTriangle) {
+			remap[v] = next++;
+		}
+	}
+
+	std::vector<float4> vertices(mesh.vertices, mesh.vertices + mesh.vertexCount);
+	std::vector<float3> normals(mesh.normals, mesh.normals + mesh.vertexCount);
+	parallelFor(mesh.vertexCount, [&](size_t begin, size_t end, unsigned int) {
+		for (size_t v = begin; v < end; v++) {
+			mesh.vertices[remap[v]] = vertices[v];
+			mesh.normals[remap[v]] = normals[v];
+			if (mesh.streams.x != nullptr) {
+				mesh.streams.write(remap[v], vertices[v], normals[v]);
+			}
+		}
+	});
+	for (size_t i = 0; i < mesh.indexCount; i++) {
+		mesh.indices[i] = remap[mesh.indices[i]];
+	}
+}
+
+void optimiseMesh(Mesh &mesh, MeshOptimisationReport *report)
+{
+	// Every vertex needs its own normal to be renumbered
+	if (mesh.indexCount < 3 || mesh.normalCount != mesh.vertexCount) {
+		return;
+	}
+	if (report != nullptr) {
+		report->before = analyseMesh(mesh);
+	}
+
+	std::vector<unsigned int> indices = optimiseVertexCache(mesh);
+	indices = optimiseOverdraw(mesh, indices);
+	std::copy(indices.begin(), indices.end(), mesh.indices);
+	optimiseVertexFetch(mesh);
+
+	if (report != nullptr) {
+		report->optimised = true;
+		report->after = analyseMesh(mesh);
+	}
+}
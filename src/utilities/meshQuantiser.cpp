@@ -0,0 +1,44 @@
+#include "meshQuantiser.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const float positionSteps = 65535.0f;
+static const float normalSteps = 32767.0f;
+
+/**
+ * @return value scaled to steps and rounded to the nearest step
+ */
+static long quantise(float value, float steps)
+{
+	return std::lround(double(value) * double(steps));
+}
+
+float3 quantisationScale(float3 const &lower, float3 const &upper)
+{
+	// The operators of float3 are not const
+	float3 extent = upper;
+	return (extent - lower) / positionSteps;
+}
+
+QuantisedVertex quantiseVertex(float4 const &position, float3 const &normal, float3 const &offset, float3 const &scale)
+{
+	// An axis without extent keeps every position at the lower end
+	auto fraction = [&](float value, float low, float step) {
+		return step > 0 ? uint16_t(std::min(std::max(quantise((value - low) / step, 1.0f), 0L), 65535L)) : uint16_t(0);
+	};
+
+	QuantisedVertex out;
+	out.x = fraction(position.x, offset.x, scale.x);
+	out.y = fraction(position.y, offset.y, scale.y);
+	out.z = fraction(position.z, offset.z, scale.z);
+	out.padding = 0;
+
+	// A missing (zero) normal is encoded as the z axis
+	float2 encoded = make_float2(0, 0);
+	if (normal.x != 0 || normal.y != 0 || normal.z != 0) {
+		encoded = octahedralEncode(normal);
+	}
+	out.normalX = int16_t(std::min(std::max(quantise(encoded.x, normalSteps), -32767L), 32767L));
+	out.normalY = int16_t(std::min(std::max(quantise(encoded.y, normalSteps), -32767L), 32767L));
+	return out;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include "geom.hpp"
+
+// Compact vertex layout of 12 bytes, instead of the 16 byte float4 position
+// and 12 byte float3 normal of every vertex.
+//
+// Positions are stored as 16-bit fractions of the bounding box of the mesh,
+// which keeps them within 1/131070 of the size of the box of their original
+// value. Normals are octahedral encoded (see geom.hpp) with 16 bits per
+// coordinate, about 0.005 degrees apart. The vertex shader decodes both on the fly.
+
+typedef struct QuantisedVertex {
+	// Position, 0 is the lower and 65535 the upper end of the bounding box
+	uint16_t x;
+	uint16_t y;
+	uint16_t z;
+	uint16_t padding;
+	// Octahedral encoded normal, -32767 to 32767 per coordinate
+	int16_t normalX;
+	int16_t normalY;
+} QuantisedVertex;
+
+/**
+ * Decodes the position of a quantised vertex
+ * @param  vertex quantised vertex
+ * @param  offset lower end of the bounding box of the mesh
+ * @param  scale  size of the bounding box divided by 65535
+ * @return        position, with w = 1
+ */
+inline float4 dequantisePosition(QuantisedVertex const &vertex, float3 const &offset, float3 const &scale) {
+	float4 position;
+	position.x = offset.x + float(vertex.x) * scale.x;
+	position.y = offset.y + float(vertex.y) * scale.y;
+	position.z = offset.z + float(vertex.z) * scale.z;
+	position.w = 1;
+	return position;
+}
+
+/**
+ * Decodes the normal of a quantised vertex
+ * @param  vertex quantised vertex
+ * @return        normalised normal
+ */
+inline float3 dequantiseNormal(QuantisedVertex const &vertex) {
+	float const scale = 1.0f / 32767.0f;
+	return octahedralDecode(make_float2(float(vertex.normalX) * scale, float(vertex.normalY) * scale));
+}
+
+/**
+ * @param  lower lower corner of the bounding box of a mesh
+ * @param  upper upper corner of the bounding box of a mesh
+ * @return       distance between neighbouring quantised positions along every axis
+ */
+float3 quantisationScale(float3 const &lower, float3 const &upper);
+
+/**
+ * Quantises a vertex (see LoadOptions::quantised)
+ * @param  position position within the bounding box of the mesh
+ * @param  normal   unit normal, or zero for a missing normal
+ * @param  offset   lower end of the bounding box of the mesh
+ * @param  scale    see quantisationScale
+ * @return          quantised vertex
+ */
+QuantisedVertex quantiseVertex(float4 const &position, float3 const &normal, float3 const &offset, float3 const &scale);
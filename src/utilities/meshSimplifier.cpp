@@ -0,0 +1,445 @@
+#include "meshSimplifier.hpp"
+#include "OBJLoader.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Vertices at the same position whose normals are further apart than this
+// angle (60 degrees) form a seam
+static const double creaseCosine = 0.5;
+// A collapse may not turn any remaining triangle by more than about 75 degrees
+static const double flipCosine = 0.25;
+// Levels stop when a level has fewer triangles than this, or when the
+// simplification stalls at more than this fraction of the level before
+static const size_t minimumLevelTriangles = 64;
+static const double stalledReduction = 0.8;
+static const unsigned int maximumLevels = 8;
+
+static const uint32_t noPosition = 0xFFFFFFFFu;
+
+/**
+ * Sum of squared distances to a set of planes, weighted by the areas of the
+ * triangles in those planes. For a plane ax + by + cz + d = 0 with a unit
+ * normal, the squared distance of p is (p, 1)^T K (p, 1) with K the outer
+ * product of (a, b, c, d); the symmetric K are simply summed.
+ */
+typedef struct Quadric {
+	double aa, ab, ac, ad, bb, bc, bd, cc, cd, dd;
+	double weight;
+
+	Quadric() {
+		aa = ab = ac = ad = bb = bc = bd = cc = cd = dd = 0;
+		weight = 0;
+	}
+
+	void addPlane(double a, double b, double c, double d, double w) {
+		aa += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+		bb += w * b * b; bc += w * b * c; bd += w * b * d;
+		cc += w * c * c; cd += w * c * d;
+		dd += w * d * d;
+		weight += w;
+	}
+
+	void add(Quadric const &other) {
+		aa += other.aa; ab += other.ab; ac += other.ac; ad += other.ad;
+		bb += other.bb; bc += other.bc; bd += other.bd;
+		cc += other.cc; cd += other.cd;
+		dd += other.dd;
+		weight += other.weight;
+	}
+
+	/**
+	 * @return weighted sum of the squared distances of a point to the planes
+	 */
+	double evaluate(double const p[3]) const {
+		double x = p[0], y = p[1], z = p[2];
+		return aa * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+			   bb * y * y + 2 * bc * y * z + 2 * bd * y +
+			   cc * z * z + 2 * cd * z +
+			   dd;
+	}
+} Quadric;
+
+typedef struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	// Mean squared distance of the merged position to the planes of both
+	double cost;
+} Collapse;
+
+/**
+ * Cross product of (b - a) and (c - a)
+ */
+static void triangleNormal(double const a[3], double const b[3], double const c[3], double normal[3])
+{
+	double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+	double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static double dot3(double const a[3], double const b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+/**
+ * Simplification state of a mesh: its welded positions with their quadrics,
+ * and the remaining triangles, whose corners always reference a vertex (with
+ * its normal) at the current position of the corner.
+ */
+typedef struct MeshSimplifier {
+	Mesh const &mesh;
+
+	// Position of every vertex, and the vertices (wedges) at every position
+	std::vector<uint32_t> positionOf;
+	std::vector<double> positions;
+	std::vector<uint32_t> wedgeOffsets;
+	std::vector<uint32_t> wedges;
+
+	std::vector<Quadric> quadrics;
+	// Positions which never move: borders, seams and non-manifold edges
+	std::vector<bool> locked;
+	std::vector<bool> removed;
+
+	std::vector<uint32_t> triangles;
+	size_t triangleCount;
+	// Largest cost of any collapse so far
+	double error;
+
+	// Triangles around every position, rebuilt for every pass
+	std::vector<uint32_t> adjacencyOffsets;
+	std::vector<uint32_t> adjacency;
+	// Scratch space of the neighbourhood tests
+	std::vector<uint32_t> marks;
+	uint32_t markStamp;
+
+	explicit MeshSimplifier(Mesh const &mesh, unsigned int const *indices, size_t indexCount) : mesh(mesh) {
+		weldPositions();
+		triangles.assign(indices, indices + indexCount);
+		triangleCount = indexCount / 3;
+		error = 0;
+		removed.assign(positionCount(), false);
+		marks.assign(positionCount(), 0);
+		markStamp = 0;
+		lockPositions();
+		computeQuadrics();
+	}
+
+	size_t positionCount() const {
+		return wedgeOffsets.size() - 1;
+	}
+
+	double const *position(uint32_t p) const {
+		return &positions[3 * p];
+	}
+
+	/**
+	 * Gives vertices with bitwise equal positions the same position number
+	 */
+	void weldPositions() {
+		std::vector<uint32_t> order(mesh.vertexCount);
+		for (size_t i = 0; i < order.size(); i++) {
+			order[i] = uint32_t(i);
+		}
+		auto less = [&](uint32_t a, uint32_t b) {
+			float4 const &va = mesh.vertices[a];
+			float4 const &vb = mesh.vertices[b];
+			return va.x < vb.x || (va.x == vb.x && (va.y < vb.y || (va.y == vb.y && (va.z < vb.z || (va.z == vb.z && a < b)))));
+		};
+		std::sort(order.begin(), order.end(), less);
+
+		positionOf.assign(mesh.vertexCount, noPosition);
+		wedgeOffsets.clear();
+		wedges.clear();
+		for (size_t i = 0; i < order.size(); i++) {
+			float4 const &vertex = mesh.vertices[order[i]];
+			if (i == 0 ||
+				vertex.x != mesh.vertices[order[i - 1]].x ||
+				vertex.y != mesh.vertices[order[i - 1]].y ||
+				vertex.z != mesh.vertices[order[i - 1]].z) {
+				wedgeOffsets.push_back(uint32_t(wedges.size()));
+				positions.push_back(vertex.x);
+				positions.push_back(vertex.y);
+				positions.push_back(vertex.z);
+			}
+			positionOf[order[i]] = uint32_t(wedgeOffsets.size() - 1);
+			wedges.push_back(order[i]);
+		}
+		wedgeOffsets.push_back(uint32_t(wedges.size()));
+	}
+
+	/**
+	 * Locks positions on borders, on non-manifold edges and on seams
+	 */
+	void lockPositions() {
+		locked.assign(positionCount(), false);
+
+		// Every edge of a closed manifold surface is used exactly once in each direction
+		std::vector<uint64_t> edges;
+		edges.reserve(triangles.size());
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (unsigned int k = 0; k < 3; k++) {
+				uint64_t a = positionOf[triangles[3 * t + k]];
+				uint64_t b = positionOf[triangles[3 * t + (k + 1) % 3]];
+				edges.push_back(a << 32 | b);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size(); i++) {
+			uint64_t a = edges[i] >> 32;
+			uint64_t b = edges[i] & 0xFFFFFFFFu;
+			auto forward = std::equal_range(edges.begin(), edges.end(), edges[i]);
+			auto backward = std::equal_range(edges.begin(), edges.end(), b << 32 | a);
+			if (a == b || forward.second - forward.first != 1 || backward.second - backward.first != 1) {
+				locked[a] = true;
+				locked[b] = true;
+			}
+		}
+
+		for (size_t p = 0; p < positionCount(); p++) {
+			for (uint32_t i = wedgeOffsets[p]; i < wedgeOffsets[p + 1] && !locked[p]; i++) {
+				for (uint32_t j = i + 1; j < wedgeOffsets[p + 1]; j++) {
+					float3 const &a = mesh.normals[wedges[i]];
+					float3 const &b = mesh.normals[wedges[j]];
+					double lengths = std::sqrt(double(a.x * a.x + a.y * a.y + a.z * a.z) * double(b.x * b.x + b.y * b.y + b.z * b.z));
+					if (!(double(a.x * b.x + a.y * b.y + a.z * b.z) >= creaseCosine * lengths)) {
+						locked[p] = true;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	void computeQuadrics() {
+		quadrics.assign(positionCount(), Quadric());
+		for (size_t t = 0; t < triangleCount; t++) {
+			uint32_t p[3] = {positionOf[triangles[3 * t]], positionOf[triangles[3 * t + 1]], positionOf[triangles[3 * t + 2]]};
+			double normal[3];
+			triangleNormal(position(p[0]), position(p[1]), position(p[2]), normal);
+			double length = std::sqrt(dot3(normal, normal));
+			if (!(length > 0) || !std::isfinite(length)) {
+				continue;
+			}
+			double a = normal[0] / length, b = normal[1] / length, c = normal[2] / length;
+			double d = -(a * position(p[0])[0] + b * position(p[0])[1] + c * position(p[0])[2]);
+			double area = 0.5 * length;
+			for (unsigned int k = 0; k < 3; k++) {
+				quadrics[p[k]].addPlane(a, b, c, d, area);
+			}
+		}
+	}
+
+	void buildAdjacency() {
+		adjacencyOffsets.assign(positionCount() + 1, 0);
+		for (size_t i = 0; i < 3 * triangleCount; i++) {
+			adjacencyOffsets[positionOf[triangles[i]] + 1]++;
+		}
+		for (size_t p = 0; p < positionCount(); p++) {
+			adjacencyOffsets[p + 1] += adjacencyOffsets[p];
+		}
+		adjacency.resize(3 * triangleCount);
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < 3 * triangleCount; i++) {
+			adjacency[fill[positionOf[triangles[i]]]++] = uint32_t(i / 3);
+		}
+	}
+
+	/**
+	 * Calls visit(q) for every neighbour of a position, possibly more than once
+	 */
+	template <typename Visit>
+	void forNeighbours(uint32_t p, Visit const &visit) const {
+		for (uint32_t i = adjacencyOffsets[p]; i < adjacencyOffsets[p + 1]; i++) {
+			uint32_t const *triangle = &triangles[3 * adjacency[i]];
+			for (unsigned int k = 0; k < 3; k++) {
+				uint32_t q = positionOf[triangle[k]];
+				if (q != p) {
+					visit(q);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Tests whether the surface stays a manifold and no triangle flips over
+	 * when position from moves onto its neighbour to
+	 */
+	bool validCollapse(uint32_t from, uint32_t to) {
+		// Link condition: the edge is shared by two triangles, so exactly the two
+		// positions opposite of it may be neighbours of both ends
+		markStamp++;
+		forNeighbours(from, [&](uint32_t q) { marks[q] = markStamp; });
+		uint32_t sharedStamp = ++markStamp;
+		unsigned int shared = 0;
+		forNeighbours(to, [&](uint32_t q) {
+			if (marks[q] == sharedStamp - 1) {
+				marks[q] = sharedStamp;
+				shared++;
+			}
+		});
+		if (shared != 2) {
+			return false;
+		}
+
+		for (uint32_t i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; i++) {
+			uint32_t const *triangle = &triangles[3 * adjacency[i]];
+			uint32_t p[3] = {positionOf[triangle[0]], positionOf[triangle[1]], positionOf[triangle[2]]};
+			if (p[0] == to || p[1] == to || p[2] == to) {
+				continue;
+			}
+			double const *before[3] = {position(p[0]), position(p[1]), position(p[2])};
+			double const *after[3] = {before[0], before[1], before[2]};
+			for (unsigned int k = 0; k < 3; k++) {
+				if (p[k] == from) {
+					after[k] = position(to);
+				}
+			}
+			double normalBefore[3];
+			double normalAfter[3];
+			triangleNormal(before[0], before[1], before[2], normalBefore);
+			triangleNormal(after[0], after[1], after[2], normalAfter);
+			if (!(dot3(normalBefore, normalAfter) > flipCosine * std::sqrt(dot3(normalBefore, normalBefore) * dot3(normalAfter, normalAfter)))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @return the vertex at a position with the normal closest to that of a vertex
+	 */
+	uint32_t closestWedge(uint32_t p, uint32_t vertex) const {
+		float3 const &normal = mesh.normals[vertex];
+		uint32_t best = wedges[wedgeOffsets[p]];
+		double bestDot = -2;
+		for (uint32_t i = wedgeOffsets[p]; i < wedgeOffsets[p + 1]; i++) {
+			float3 const &candidate = mesh.normals[wedges[i]];
+			double d = double(normal.x) * candidate.x + double(normal.y) * candidate.y + double(normal.z) * candidate.z;
+			if (d > bestDot) {
+				bestDot = d;
+				best = wedges[i];
+			}
+		}
+		return best;
+	}
+
+	/**
+	 * Collapses edges until at most targetTriangleCount triangles are left, or
+	 * no edge can be collapsed anymore. Every pass collapses the cheapest edges
+	 * whose neighbourhoods do not overlap, so the tests of one collapse are not
+	 * affected by the others in the same pass.
+	 * @param  targetTriangleCount number of triangles to reduce the mesh to
+	 * @return                     number of triangles left
+	 */
+	size_t simplify(size_t targetTriangleCount) {
+		std::vector<Collapse> candidates;
+		std::vector<bool> touched;
+		std::vector<uint32_t> collapseTo(positionCount(), noPosition);
+
+		while (triangleCount > targetTriangleCount) {
+			buildAdjacency();
+
+			candidates.clear();
+			for (uint32_t from = 0; from < positionCount(); from++) {
+				if (locked[from] || removed[from] || adjacencyOffsets[from] == adjacencyOffsets[from + 1]) {
+					continue;
+				}
+				Collapse best;
+				best.from = from;
+				best.to = noPosition;
+				best.cost = 0;
+				forNeighbours(from, [&](uint32_t to) {
+					Quadric merged = quadrics[from];
+					merged.add(quadrics[to]);
+					double cost = merged.weight > 0 ? std::max(0.0, merged.evaluate(position(to)) / merged.weight) : 0;
+					if ((best.to == noPosition || cost < best.cost) && validCollapse(from, to)) {
+						best.to = to;
+						best.cost = cost;
+					}
+				});
+				if (best.to != noPosition) {
+					candidates.push_back(best);
+				}
+			}
+			std::sort(candidates.begin(), candidates.end(), [](Collapse const &a, Collapse const &b) {
+				return a.cost < b.cost || (a.cost == b.cost && a.from < b.from);
+			});
+
+			// An edge collapse removes the two triangles of the edge
+			size_t budget = (triangleCount - targetTriangleCount + 1) / 2;
+			size_t collapses = 0;
+			touched.assign(positionCount(), false);
+			for (size_t i = 0; i < candidates.size() && collapses < budget; i++) {
+				Collapse const &collapse = candidates[i];
+				if (touched[collapse.from] || touched[collapse.to]) {
+					continue;
+				}
+				touched[collapse.from] = true;
+				touched[collapse.to] = true;
+				forNeighbours(collapse.from, [&](uint32_t q) { touched[q] = true; });
+
+				collapseTo[collapse.from] = collapse.to;
+				removed[collapse.from] = true;
+				quadrics[collapse.to].add(quadrics[collapse.from]);
+				error = std::max(error, collapse.cost);
+				collapses++;
+			}
+			if (collapses == 0) {
+				break;
+			}
+
+			// Moves the corners onto the vertex at the new position with the
+			// closest normal, and drops the triangles which lost their area
+			size_t kept = 0;
+			for (size_t t = 0; t < triangleCount; t++) {
+				uint32_t corners[3];
+				for (unsigned int k = 0; k < 3; k++) {
+					corners[k] = triangles[3 * t + k];
+					uint32_t p = positionOf[corners[k]];
+					if (removed[p]) {
+						corners[k] = closestWedge(collapseTo[p], corners[k]);
+					}
+				}
+				uint32_t p0 = positionOf[corners[0]], p1 = positionOf[corners[1]], p2 = positionOf[corners[2]];
+				if (p0 == p1 || p1 == p2 || p0 == p2) {
+					continue;
+				}
+				triangles[3 * kept + 0] = corners[0];
+				triangles[3 * kept + 1] = corners[1];
+				triangles[3 * kept + 2] = corners[2];
+				kept++;
+			}
+			triangleCount = kept;
+			triangles.resize(3 * kept);
+		}
+		return triangleCount;
+	}
+} MeshSimplifier;
+
+void buildLevelsOfDetail(Mesh &mesh, std::vector<unsigned int> &lodIndices)
+{
+	if (mesh.normalCount != mesh.vertexCount || mesh.indexCount / 3 < 2 * minimumLevelTriangles) {
+		return;
+	}
+
+	MeshSimplifier simplifier(mesh, mesh.indices, mesh.indexCount / 3 * 3);
+	size_t previousTriangles = mesh.indexCount / 3;
+	while (mesh.lods.size() < maximumLevels && previousTriangles / 2 >= minimumLevelTriangles) {
+		size_t triangles = simplifier.simplify(previousTriangles / 2);
+		if (double(triangles) > stalledReduction * double(previousTriangles)) {
+			break;
+		}
+		MeshLOD level;
+		level.indexOffset = lodIndices.size();
+		level.indexCount = 3 * triangles;
+		level.error = float(std::sqrt(simplifier.error));
+		lodIndices.insert(lodIndices.end(), simplifier.triangles.begin(), simplifier.triangles.end());
+		mesh.lods.push_back(level);
+		previousTriangles = triangles;
+	}
+}
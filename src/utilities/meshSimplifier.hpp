@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+struct Mesh;
+
+// Levels of detail (LODs): coarser versions of a mesh for when it covers too
+// few pixels to show all of its triangles.
+//
+// Levels are built by quadric edge collapse ("Surface Simplification Using
+// Quadric Error Metrics", Garland and Heckbert): every position keeps the sum
+// of the squared distances to the planes of its original triangles, and the
+// edge whose collapse moves the surface the least is collapsed first. An edge
+// collapse moves one position onto a neighbouring one, so the levels only
+// reference vertices of the mesh itself and share its vertex and normal buffers.
+//
+// Positions on the border of an open mesh, and positions on a normal seam
+// (vertices at the same position with normals further apart than a crease
+// angle) never move, so silhouettes of open meshes and hard edges are kept.
+
+typedef struct MeshLOD {
+	// The triangles of the level are Mesh::lodIndices[indexOffset .. indexOffset + indexCount)
+	size_t indexOffset;
+	size_t indexCount;
+	// Root mean square distance between the level and the surface of the
+	// full mesh, in the units of the mesh
+	float error;
+} MeshLOD;
+
+/**
+ * Builds a chain of levels of detail, each with about half the triangles of
+ * the one before, until the mesh can not be simplified any further. The
+ * triangles of every level keep the order of the triangles of the mesh.
+ * @param mesh       Mesh object with 32-bit indices; its normals must be
+ *                   indexed like its vertices. The levels are added to its lods.
+ * @param lodIndices returned triangles of all levels, which become
+ *                   Mesh::lodIndices when the mesh is stored in its final layout
+ */
+void buildLevelsOfDetail(Mesh &mesh, std::vector<unsigned int> &lodIndices);
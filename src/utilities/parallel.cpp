@@ -0,0 +1,15 @@
+#include "parallel.hpp"
+
+static unsigned int requestedThreadCount = 0;
+
+unsigned int workerThreadCount() {
+	if (requestedThreadCount != 0) {
+		return requestedThreadCount;
+	}
+	unsigned int hardwareThreads = std::thread::hardware_concurrency();
+	return hardwareThreads == 0 ? 1 : hardwareThreads;
+}
+
+void setWorkerThreadCount(unsigned int count) {
+	requestedThreadCount = count;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Number of worker threads used by the parallel stages of the renderer.
+ * Defaults to the number of hardware threads of the machine.
+ * @return worker thread count (at least 1)
+ */
+unsigned int workerThreadCount();
+
+/**
+ * Overrides the number of worker threads, 0 restores the default
+ * @param count number of worker threads
+ */
+void setWorkerThreadCount(unsigned int count);
+
+/**
+ * Splits the range [0, count) in contiguous chunks, one per worker thread,
+ * and calls function(begin, end, threadIndex) for every chunk. The calling
+ * thread processes the first chunk itself, and the call returns once all
+ * chunks are finished.
+ *
+ * Because every thread always gets the same chunk for the same count, memory
+ * that is first written inside function ends up on the memory node of the
+ * thread that owns that chunk (first-touch placement).
+ *
+ * @param count    number of items in the range
+ * @param function callable with signature void(size_t, size_t, unsigned int)
+ */
+template <typename Function>
+void parallelFor(size_t const count, Function function)
+{
+	size_t threadCount = workerThreadCount();
+	if (threadCount > count) {
+		threadCount = count;
+	}
+	if (threadCount <= 1) {
+		function(size_t(0), count, 0u);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+
+	for (size_t i = 1; i < threadCount; i++) {
+		size_t begin = (count * i) / threadCount;
+		size_t end = (count * (i + 1)) / threadCount;
+		threads.push_back(std::thread(function, begin, end, (unsigned int) i));
+	}
+	function(size_t(0), count / threadCount, 0u);
+
+	for (unsigned int i = 0; i < threads.size(); i++) {
+		threads.at(i).join();
+	}
+}
+
+/**
+ * Allocator which leaves trivially constructible elements uninitialised on
+ * resize. std::vector normally zero-fills new elements from the thread that
+ * calls resize(), which touches (and therefore places) every page of the
+ * buffer on that thread. With this allocator the first write happens inside
+ * the worker that produces the data.
+ */
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T> {
+	template <typename U>
+	struct rebind {
+		typedef FirstTouchAllocator<U> other;
+	};
+
+	FirstTouchAllocator() {}
+
+	template <typename U>
+	FirstTouchAllocator(FirstTouchAllocator<U> const &) {}
+
+	template <typename U>
+	void construct(U *pointer) {
+		::new((void *) pointer) U;
+	}
+
+	template <typename U, typename... Args>
+	void construct(U *pointer, Args&&... args) {
+		::new((void *) pointer) U(std::forward<Args>(args)...);
+	}
+};
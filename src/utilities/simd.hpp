@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// Portable 8-wide vectors using the GCC/Clang vector extensions. Arithmetic on
+// them compiles to SSE (two registers) or AVX (one register) instructions
+// depending on the target flags. Other compilers (MSVC) get plain structs with
+// the same operators, which do the work one lane at a time.
+//
+// Vectors are passed by reference: without AVX enabled, GCC warns that
+// passing 32 byte vectors by value has an unstable ABI.
+
+#if defined(__GNUC__)
+
+typedef float float8 __attribute__ ((vector_size (32)));
+
+// Result of comparing two float8: every lane is all ones (true) or all zeros (false)
+typedef int32_t mask8 __attribute__ ((vector_size (32)));
+
+#else
+
+typedef struct alignas(32) float8 {
+	float lanes[8];
+
+	float &operator[] (size_t i) { return lanes[i]; }
+	float operator[] (size_t i) const { return lanes[i]; }
+} float8;
+
+// Result of comparing two float8: every lane is all ones (true) or all zeros (false)
+typedef struct alignas(32) mask8 {
+	int32_t lanes[8];
+
+	int32_t &operator[] (size_t i) { return lanes[i]; }
+	int32_t operator[] (size_t i) const { return lanes[i]; }
+} mask8;
+
+// Lane-wise operators, with a scalar on either side standing for a vector
+// with that value in every lane, as with the vector extensions
+#define FLOAT8_ARITHMETIC(op) \
+	inline float8 operator op (float8 const &a, float8 const &b) \
+	{ \
+		float8 result; \
+		for (unsigned int i = 0; i < 8; i++) { \
+			result.lanes[i] = a.lanes[i] op b.lanes[i]; \
+		} \
+		return result; \
+	} \
+	inline float8 operator op (float8 const &a, float b) \
+	{ \
+		float8 result; \
+		for (unsigned int i = 0; i < 8; i++) { \
+			result.lanes[i] = a.lanes[i] op b; \
+		} \
+		return result; \
+	} \
+	inline float8 operator op (float a, float8 const &b) \
+	{ \
+		float8 result; \
+		for (unsigned int i = 0; i < 8; i++) { \
+			result.lanes[i] = a op b.lanes[i]; \
+		} \
+		return result; \
+	} \
+	inline float8 &operator op##= (float8 &a, float8 const &b) \
+	{ \
+		a = a op b; \
+		return a; \
+	}
+
+#define FLOAT8_COMPARISON(op) \
+	inline mask8 operator op (float8 const &a, float8 const &b) \
+	{ \
+		mask8 result; \
+		for (unsigned int i = 0; i < 8; i++) { \
+			result.lanes[i] = a.lanes[i] op b.lanes[i] ? -1 : 0; \
+		} \
+		return result; \
+	}
+
+#define MASK8_BITWISE(op) \
+	inline mask8 operator op (mask8 const &a, mask8 const &b) \
+	{ \
+		mask8 result; \
+		for (unsigned int i = 0; i < 8; i++) { \
+			result.lanes[i] = a.lanes[i] op b.lanes[i]; \
+		} \
+		return result; \
+	}
+
+FLOAT8_ARITHMETIC(+)
+FLOAT8_ARITHMETIC(-)
+FLOAT8_ARITHMETIC(*)
+FLOAT8_ARITHMETIC(/)
+FLOAT8_COMPARISON(<)
+FLOAT8_COMPARISON(>)
+FLOAT8_COMPARISON(==)
+MASK8_BITWISE(&)
+MASK8_BITWISE(|)
+
+#undef FLOAT8_ARITHMETIC
+#undef FLOAT8_COMPARISON
+#undef MASK8_BITWISE
+
+inline float8 operator- (float8 const &a)
+{
+	float8 result;
+	for (unsigned int i = 0; i < 8; i++) {
+		result.lanes[i] = -a.lanes[i];
+	}
+	return result;
+}
+
+inline mask8 operator~ (mask8 const &a)
+{
+	mask8 result;
+	for (unsigned int i = 0; i < 8; i++) {
+		result.lanes[i] = ~a.lanes[i];
+	}
+	return result;
+}
+
+#endif
+
+/**
+ * Reinterprets the bits of every lane as an integer
+ * @param x      input values
+ * @param result returned bits
+ */
+inline void bitsOf8(float8 const &x, mask8 &result)
+{
+#if defined(__GNUC__)
+	result = (mask8) x;
+#else
+	std::memcpy(&result, &x, sizeof(mask8));
+#endif
+}
+
+/**
+ * Reinterprets the bits of every lane as a float
+ * @param bits   input bits
+ * @param result returned values
+ */
+inline void floatsOf8(mask8 const &bits, float8 &result)
+{
+#if defined(__GNUC__)
+	result = (float8) bits;
+#else
+	std::memcpy(&result, &bits, sizeof(float8));
+#endif
+}
+
+/**
+ * Picks every lane from one of two vectors
+ * @param mask   lanes to take from a
+ * @param a      values where the mask is true
+ * @param b      values where the mask is false
+ * @param result returned values
+ */
+inline void select8(mask8 const &mask, float8 const &a, float8 const &b, float8 &result)
+{
+	mask8 bitsA;
+	mask8 bitsB;
+	bitsOf8(a, bitsA);
+	bitsOf8(b, bitsB);
+	floatsOf8((bitsA & mask) | (bitsB & ~mask), result);
+}
+
+/**
+ * Fast approximate 1 / sqrt(x), refined with one Newton-Raphson step. The
+ * result has a relative error of about 1e-7 (the hardware estimate alone is
+ * only accurate to 12 bits).
+ * @param x      input values
+ * @param result returned approximation of 1 / sqrt(x) for every lane
+ */
+inline void rsqrt8(float8 const &x, float8 &result)
+{
+	float8 estimate;
+#if defined(__AVX__) && defined(__GNUC__)
+	estimate = (float8) _mm256_rsqrt_ps((__m256) x);
+#elif defined(__SSE__)
+	union {
+		float8 vector;
+		__m128 halves[2];
+	} lanes;
+	lanes.vector = x;
+	lanes.halves[0] = _mm_rsqrt_ps(lanes.halves[0]);
+	lanes.halves[1] = _mm_rsqrt_ps(lanes.halves[1]);
+	estimate = lanes.vector;
+#else
+	for (unsigned int i = 0; i < 8; i++) {
+		estimate[i] = 1.0f / std::sqrt(x[i]);
+	}
+#endif
+	// y' = y * (1.5 - 0.5 * x * y * y)
+	float8 const half = {0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f};
+	float8 const threeHalves = {1.5f, 1.5f, 1.5f, 1.5f, 1.5f, 1.5f, 1.5f, 1.5f};
+	result = estimate * (threeHalves - half * x * estimate * estimate);
+}
+
+/**
+ * Converts 8 intensities to grey, opaque, packed RGBA colours (R = G = B = value,
+ * A = 255). Values are truncated to integers, and then clamped to 0..255 by
+ * saturating packs.
+ * @param values  intensities, 0 to 255
+ * @param colours returned packed colours
+ */
+inline void packGreyColours8(float8 const &values, uint32_t *colours)
+{
+#if defined(__SSE2__)
+	union {
+		float8 vector;
+		__m128 halves[2];
+	} lanes;
+	lanes.vector = values;
+	__m128i low = _mm_cvttps_epi32(lanes.halves[0]);
+	__m128i high = _mm_cvttps_epi32(lanes.halves[1]);
+	// int32 -> int16 -> uint8, saturating at every step
+	__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(low, high), _mm_setzero_si128());
+	// Replicate every byte into the R, G and B channels, and set A to 255
+	__m128i pairs = _mm_unpacklo_epi8(bytes, bytes);
+	__m128i alpha = _mm_set1_epi32(int32_t(0xFF000000u));
+	__m128i first = _mm_or_si128(_mm_unpacklo_epi16(pairs, pairs), alpha);
+	__m128i second = _mm_or_si128(_mm_unpackhi_epi16(pairs, pairs), alpha);
+	_mm_storeu_si128((__m128i *) colours, first);
+	_mm_storeu_si128((__m128i *) (colours + 4), second);
+#else
+	for (unsigned int i = 0; i < 8; i++) {
+		float value = values[i];
+		unsigned char grey = value >= 255.0f ? 255 : value > 0.0f ? (unsigned char) value : 0;
+		unsigned char *channels = (unsigned char *) (colours + i);
+		channels[0] = grey;
+		channels[1] = grey;
+		channels[2] = grey;
+		channels[3] = 255;
+	}
+#endif
+}
+
+/**
+ * Approximate arc cosine, with an absolute error of less than 7e-5 radians
+ * (Abramowitz and Stegun, formula 4.4.45)
+ * @param x      cosines, clamped to -1..1
+ * @param result returned angles, 0 to pi
+ */
+inline void acos8(float8 const &x, float8 &result)
+{
+	float8 const zero = {0, 0, 0, 0, 0, 0, 0, 0};
+	float8 const one = {1, 1, 1, 1, 1, 1, 1, 1};
+	float8 const pi = {3.14159265f, 3.14159265f, 3.14159265f, 3.14159265f,
+					   3.14159265f, 3.14159265f, 3.14159265f, 3.14159265f};
+	mask8 const signBit = {INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN,
+						   INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN};
+
+	mask8 bits;
+	bitsOf8(x, bits);
+	float8 absolute;
+	floatsOf8(bits & ~signBit, absolute);
+	select8(absolute > one, one, absolute, absolute);
+
+	// acos(|x|) ~ sqrt(1 - |x|) * polynomial(|x|)
+	float8 polynomial = ((-0.0187293f * absolute + 0.0742610f) * absolute - 0.2121144f) * absolute + 1.5707288f;
+	float8 oneMinus = one - absolute;
+	float8 inverseRoot;
+	// The square root is x / sqrt(x), which is 0 for x = 0 as long as 1 / sqrt(x) stays finite
+	float8 const smallest = {1e-30f, 1e-30f, 1e-30f, 1e-30f, 1e-30f, 1e-30f, 1e-30f, 1e-30f};
+	float8 clamped;
+	select8(oneMinus > smallest, oneMinus, smallest, clamped);
+	rsqrt8(clamped, inverseRoot);
+	float8 angle = oneMinus * inverseRoot * polynomial;
+
+	// acos(-x) = pi - acos(x)
+	select8(x < zero, pi - angle, angle, result);
+}
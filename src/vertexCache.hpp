@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "utilities/geom.hpp"
+
+// A post-transform vertex cache remembers the output of the vertex shader for
+// the most recently referenced vertices. When the index buffer references a
+// vertex that is still in the cache, its transformed position and normal can be
+// reused instead of running the vertex shader again.
+//
+// The cache is direct-mapped: a vertex index always maps to the same entry, and
+// a newer vertex simply replaces whatever was stored there. With 512 entries of
+// 36 bytes the whole cache takes 18 KiB, small enough to stay in the L1 cache.
+
+typedef struct VertexCacheEntry {
+	unsigned int index;
+	float4 position;
+	float4 normal;
+} VertexCacheEntry;
+
+typedef struct VertexCacheStatistics {
+	size_t references;
+	size_t misses;
+
+	VertexCacheStatistics() {
+		references = 0;
+		misses = 0;
+	}
+
+	void add(VertexCacheStatistics other) {
+		references += other.references;
+		misses += other.misses;
+	}
+
+	/**
+	 * @return fraction of references which had to run the vertex shader
+	 */
+	float missRatio() {
+		return references == 0 ? 0.0f : float(misses) / float(references);
+	}
+
+	/**
+	 * Average cache miss ratio, the number of vertex shader invocations per triangle.
+	 * 3 means no reuse at all, a well ordered closed mesh gets close to 0.5.
+	 * @return vertex shader invocations per triangle
+	 */
+	float averageCacheMissRatio() {
+		return references == 0 ? 0.0f : 3.0f * float(misses) / float(references);
+	}
+} VertexCacheStatistics;
+
+typedef struct VertexCache {
+	static const unsigned int size = 512;
+	static const unsigned int emptyIndex = 0xFFFFFFFFu;
+
+	VertexCacheEntry entries[size];
+	VertexCacheStatistics statistics;
+
+	VertexCache() {
+		clear();
+	}
+
+	void clear() {
+		for (unsigned int i = 0; i < size; i++) {
+			entries[i].index = emptyIndex;
+		}
+	}
+
+	/**
+	 * Looks up the cache entry of a vertex. On a miss the entry is claimed for
+	 * the vertex, and the caller must fill in its position and normal.
+	 * @param  index vertex index from the index buffer
+	 * @param  miss  returns whether the vertex was not in the cache
+	 * @return       cache entry of the vertex
+	 */
+	VertexCacheEntry &lookup(unsigned int const index, bool &miss) {
+		VertexCacheEntry &entry = entries[index & (size - 1)];
+		statistics.references++;
+		miss = entry.index != index;
+		if (miss) {
+			statistics.misses++;
+			entry.index = index;
+		}
+		return entry;
+	}
+} VertexCache;
+
+/**
+ * Simulates the vertex cache on an index buffer, without running the vertex
+ * shader, to measure how well the triangles are ordered for it. The results
+ * are the same as those of looking up every index in a VertexCache.
+ * @param  indices    index buffer, of either width
+ * @param  indexCount length of the index buffer
+ * @return            vertex cache statistics of the index buffer
+ */
+template <typename Index>
+VertexCacheStatistics simulateVertexCache(Index const *indices, size_t indexCount) {
+	// Only the tags of the entries are needed
+	std::vector<unsigned int> cachedIndices(VertexCache::size, VertexCache::emptyIndex);
+	VertexCacheStatistics statistics;
+	for (size_t i = 0; i < indexCount; i++) {
+		unsigned int index = indices[i];
+		unsigned int &cachedIndex = cachedIndices[index & (VertexCache::size - 1)];
+		statistics.references++;
+		if (cachedIndex != index) {
+			statistics.misses++;
+			cachedIndex = index;
+		}
+	}
+	return statistics;
+}